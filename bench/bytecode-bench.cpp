@@ -0,0 +1,109 @@
+/*
+* Copyright 2019 PragmaTwice
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include "chtholly.hpp"
+#include "chtholly/irgenerator.hpp"
+#include "chtholly/bytecode.hpp"
+
+using namespace std;
+using namespace Chtholly;
+
+string MakeSource(size_t repeat)
+{
+	// only constructs which the IR generator supports
+	static const auto snippet = R"(var (a, c...) (1; [2.33, null, "s"]); const x [a, c]; [1, [2, [x]]], a)"s;
+
+	string source;
+	for (size_t i = 0; i < repeat; ++i)
+	{
+		if (i != 0) source += ";\n";
+		source += snippet;
+	}
+	return source;
+}
+
+template <typename F>
+double Measure(F&& f)
+{
+	const auto beginTime = chrono::system_clock::now();
+	f();
+	const auto endTime = chrono::system_clock::now();
+
+	return chrono::duration<double>(endTime - beginTime).count();
+}
+
+// touch every operand of a packed module, as an interpreter would
+template <typename Module>
+size_t Inspect(const Module& module)
+{
+	size_t symbols = 0;
+	for (size_t i = 0; i < module.size(); ++i)
+	{
+		const auto& packed = module[i];
+		for (size_t j = 0; j < packed.size; ++j)
+		{
+			if (packed.kinds[j] == OperandKind::symbol) symbols += module.symbolOperand(packed, j) + 1;
+		}
+	}
+	return symbols;
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t repeat = argc > 1 ? stoul(argv[1]) : 1000;
+	const auto source = MakeSource(repeat);
+	const string path = argc > 2 ? argv[2] : "bytecode-bench.bin";
+
+	IRGenerator::Sequence seq;
+	const auto compileTime = Measure([&] {
+		ParseTree tree;
+		Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+		seq = IRGenerator::Generate(tree);
+	});
+
+	PackedSequence packed;
+	const auto packTime = Measure([&] {
+		packed = PackedSequence(seq);
+	});
+
+	size_t moduleBytes = 0;
+	const auto writeTime = Measure([&] {
+		ofstream out(path, ios::binary);
+		BytecodeImage::Write(out, packed);
+		moduleBytes = size_t(out.tellp());
+	});
+
+	size_t inspected = 0;
+	const auto loadTime = Measure([&] {
+		const BytecodeModule module(path);
+		inspected = Inspect(module);
+	});
+
+	bool same = false;
+	const auto loadUnpackTime = Measure([&] {
+		const BytecodeModule module(path);
+		same = module.unpack() == seq;
+	});
+
+	cout << "Source size    : " << source.size() << " bytes" << endl;
+	cout << "Instructions   : " << seq.size() << endl;
+	cout << "Module size    : " << moduleBytes << " bytes" << endl;
+	cout << "Symbols        : " << packed.symbols().size() << endl;
+	cout << endl;
+
+	cout << "Parse+generate : " << compileTime << "s" << endl;
+	cout << "Pack time      : " << packTime << "s" << endl;
+	cout << "Write time     : " << writeTime << "s" << endl;
+	cout << "Load+inspect   : " << loadTime << "s" << endl;
+	cout << "Load+unpack    : " << loadUnpackTime << "s" << endl;
+	cout << "Speedup        : " << compileTime / loadTime << endl;
+	cout << "Same result    : " << boolalpha << same << " (" << inspected << ")" << endl;
+
+	remove(path.c_str());
+}
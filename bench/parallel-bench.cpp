@@ -0,0 +1,129 @@
+/*
+* Copyright 2019 PragmaTwice
+*/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "chtholly.hpp"
+#include "chtholly/hashcons.hpp"
+#include "chtholly/parallelvisit.hpp"
+
+using namespace std;
+using namespace Chtholly;
+
+template <typename F>
+double Measure(F&& f)
+{
+	const auto beginTime = chrono::system_clock::now();
+	f();
+	const auto endTime = chrono::system_clock::now();
+
+	return chrono::duration<double>(endTime - beginTime).count();
+}
+
+// Append a copy of the subtree under src to the children of dst
+void AppendCopy(ParseTree::Modifier dst, ParseTree::Observer src)
+{
+	vector<pair<ParseTree::Modifier, ParseTree::Observer>> pending{ { dst, src } };
+
+	while (!pending.empty())
+	{
+		auto [to, from] = pending.back();
+		pending.pop_back();
+
+		to.childrenPushBack(from.value());
+		auto copied = --to.childrenEnd();
+		for (auto child = from.childrenBegin(); child != from.childrenEnd(); ++child) pending.emplace_back(copied, child);
+	}
+}
+
+size_t CountNodes(ParseTree::Observer root)
+{
+	size_t count = 0;
+	for (vector<ParseTree::Observer> pending{ root }; !pending.empty();)
+	{
+		auto current = pending.back();
+		pending.pop_back();
+
+		++count;
+		for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child) pending.push_back(child);
+	}
+	return count;
+}
+
+// the analysis of a subtree: its identifiers and its structural hash
+struct Summary
+{
+	size_t identifiers = 0;
+	size_t hash = 0;
+};
+
+Summary Analyse(const ParseTree::Observer& root)
+{
+	Summary summary{ 0, StructuralHash(root) };
+	for (vector<ParseTree::Observer> pending{ root }; !pending.empty();)
+	{
+		auto current = pending.back();
+		pending.pop_back();
+
+		if (current.value().name == ParseUnitName::Predefined("Identifier")) ++summary.identifiers;
+		for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child) pending.push_back(child);
+	}
+	return summary;
+}
+
+Summary Merge(Summary lhs, const Summary& rhs)
+{
+	return { lhs.identifiers + rhs.identifiers, HashCombine(lhs.hash, rhs.hash) };
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t targetNodes = argc > 1 ? stoul(argv[1]) : 100000;
+	const size_t threads = argc > 2 ? stoul(argv[2]) : max(thread::hardware_concurrency(), 1u);
+
+	const auto snippet = R"(var (a, b : int, c...) (1, 2.5, "s"); fn (x) if (x > 0) x * 2 + a else -x; [a, {b : c}, 3 -> f(4)])"s;
+	ParseTree parsed;
+	Parser::Expression(Parser::MakeInfo(snippet, parsed.modifier()));
+
+	// repeat the top-level expressions of the snippet until the tree is big enough
+	ParseTree tree;
+	auto expression = tree.modifier();
+	expression.childrenPushBack(ParseUnit::Type::term, "Expression");
+	expression = expression.childrenBegin();
+
+	size_t nodeCount = 2;
+	const auto snippetExpression = parsed.observer().childrenBegin();
+	while (nodeCount < targetNodes)
+	{
+		for (auto child = snippetExpression.childrenBegin(); child != snippetExpression.childrenEnd(); ++child)
+		{
+			AppendCopy(expression, child);
+		}
+		nodeCount = CountNodes(tree.observer());
+	}
+
+	const ParseTree& source = tree;
+	const auto top = source.observer().childrenBegin();
+
+	Summary serial, parallel;
+	const auto serialTime = Measure([&] {
+		for (auto child = top.childrenBegin(); child != top.childrenEnd(); ++child) serial = Merge(serial, Analyse(child));
+	});
+
+	ThreadPool pool(threads);
+	const auto parallelTime = Measure([&] {
+		parallel = ParallelVisitChildren<Summary>(pool, top, Analyse, Merge);
+	});
+
+	cout << "Node count     : " << nodeCount << endl;
+	cout << "Tasks          : " << top.childrenSize() << endl;
+	cout << "Threads        : " << pool.size() << endl;
+	cout << "Serial time    : " << serialTime << "s" << endl;
+	cout << "Parallel time  : " << parallelTime << "s" << endl;
+	cout << "Speedup        : " << serialTime / parallelTime << endl;
+	cout << "Same result    : " << boolalpha << (serial.identifiers == parallel.identifiers && serial.hash == parallel.hash) << endl;
+}
@@ -0,0 +1,210 @@
+/*
+* Copyright 2019 PragmaTwice
+*/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <optional>
+#include "chtholly.hpp"
+#include "chtholly/flattree.hpp"
+
+using namespace std;
+using namespace Chtholly;
+
+static size_t allocatedBytes = 0;
+static size_t allocatedCount = 0;
+
+void* operator new(size_t size)
+{
+	allocatedBytes += size;
+	++allocatedCount;
+
+	if (void* p = malloc(size)) return p;
+	throw bad_alloc();
+}
+
+// kept out of line, otherwise GCC sees free() on a pointer from operator new at the inlined call sites
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+string MakeSource(size_t repeat)
+{
+	static const auto snippet = R"(var (a, b : int, c...) (1, 2.5, "s"); fn (x) if (x > 0) x * 2 + a else -x; [a, {b : c}, 3 -> f(4)])"s;
+
+	string source;
+	for (size_t i = 0; i < repeat; ++i)
+	{
+		if (i != 0) source += ";\n";
+		source += snippet;
+	}
+	return source;
+}
+
+template <typename Observer>
+size_t CountNodes(const Observer& v)
+{
+	size_t count = 1;
+	for (auto i = v.childrenBegin(); i != v.childrenEnd(); ++i)
+	{
+		count += CountNodes(i);
+	}
+	return count;
+}
+
+template <typename F>
+double Measure(F&& f)
+{
+	const auto beginTime = chrono::system_clock::now();
+	f();
+	const auto endTime = chrono::system_clock::now();
+
+	return chrono::duration<double>(endTime - beginTime).count();
+}
+
+struct Allocation
+{
+	size_t bytes, count;
+
+	template <typename F>
+	explicit Allocation(F&& f)
+	{
+		const auto bytesBefore = allocatedBytes, countBefore = allocatedCount;
+		f();
+		bytes = allocatedBytes - bytesBefore;
+		count = allocatedCount - countBefore;
+	}
+};
+
+struct CountingSink
+{
+	size_t events = 0;
+
+	void enterTerm(const ParseUnitName&) { ++events; }
+	void token(const ParseUnitName&, string_view) { ++events; }
+	void exitTerm(bool) { ++events; }
+	void discard() { ++events; }
+};
+
+int main(int argc, char* argv[])
+{
+	const size_t repeat = argc > 1 ? stoul(argv[1]) : 100;
+	const auto source = MakeSource(repeat);
+
+	ParseTree tree;
+	double parseTime = 0;
+	Allocation parseAlloc([&] {
+		parseTime = Measure([&] {
+			Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+		});
+	});
+
+	const ParseTree& parsed = tree;
+	const auto nodeCount = CountNodes(parsed.observer());
+
+	cout << "Source size    : " << source.size() << " bytes" << endl;
+	cout << "Node count     : " << nodeCount << endl;
+	cout << "Parse time     : " << parseTime << "s" << endl;
+	cout << "Allocations    : " << parseAlloc.count << endl;
+	cout << endl;
+
+	{
+		const auto stats = parsed.stats();
+
+		cout << "[Stats]" << endl;
+		cout << "Tokens / terms : " << stats.tokenCount << " / " << stats.termCount << endl;
+		cout << "Max depth      : " << stats.maxDepth << endl;
+		cout << "Single child   : " << stats.singleChildShare() * 100 << "%" << endl;
+		cout << "Node bytes     : " << stats.nodeBytes << endl;
+		cout << "Name bytes     : " << stats.nameBytes << endl;
+		cout << endl;
+	}
+
+	{
+		CountingSink sink;
+		double eventTime = 0;
+		Allocation alloc([&] {
+			eventTime = Measure([&] {
+				EventParser<CountingSink>::Builder::Context context(sink);
+				EventParser<CountingSink>::Expression(EventParser<CountingSink>::MakeInfo(source, context.cursor()));
+				context.finish();
+			});
+		});
+
+		cout << "[Events]" << endl;
+		cout << "Parse time     : " << eventTime << "s (no tree)" << endl;
+		cout << "Allocations    : " << alloc.count << endl;
+		cout << "Events         : " << sink.events << endl;
+		cout << endl;
+	}
+
+	double treeBytesPerNode = 0;
+	{
+		double copyTime = 0;
+		Allocation alloc([&] {
+			copyTime = Measure([&] {
+				ParseTree copy(parsed);
+			});
+		});
+
+		cout << "[ParseTree]" << endl;
+		cout << "Build time     : " << parseTime << "s (parse)" << endl;
+		cout << "Copy time      : " << copyTime << "s" << endl;
+		cout << "Allocations    : " << alloc.count << " (copy)" << endl;
+		treeBytesPerNode = double(alloc.bytes) / nodeCount;
+		cout << "Bytes per node : " << treeBytesPerNode << endl;
+		cout << "Walk time      : " << Measure([&] { CountNodes(tree.observer()); }) << "s" << endl;
+		cout << endl;
+	}
+
+	{
+		double flattenTime = 0;
+		size_t flatBytes = 0;
+		Allocation alloc([&] {
+			flattenTime = Measure([&] {
+				FlatParseTree flat(tree);
+				flatBytes = flat.capacityBytes();
+			});
+		});
+
+		const FlatParseTree flat(tree);
+
+		cout << "[FlatParseTree]" << endl;
+		cout << "Build time     : " << flattenTime << "s (from ParseTree)" << endl;
+		cout << "Allocations    : " << alloc.count << endl;
+		const auto flatBytesPerNode = double(flatBytes) / nodeCount;
+		cout << "Bytes per node : " << flatBytesPerNode << " (" << (1 - flatBytesPerNode / treeBytesPerNode) * 100 << "% less than ParseTree)" << endl;
+		cout << "Walk time      : " << Measure([&] { CountNodes(flat.observer()); }) << "s" << endl;
+	}
+
+	{
+		MonotonicArena arena;
+		optional<ArenaParseTree> arenaTree(in_place, allocator_arg, arena);
+
+		double arenaParseTime = 0;
+		Allocation alloc([&] {
+			arenaParseTime = Measure([&] {
+				ArenaParser::Expression(ArenaParser::MakeInfo(source, arenaTree->modifier()));
+			});
+		});
+
+		cout << endl;
+		cout << "[ArenaParseTree]" << endl;
+		cout << "Parse time     : " << arenaParseTime << "s" << endl;
+		cout << "Allocations    : " << alloc.count << " (" << parseAlloc.count - alloc.count << " fewer)" << endl;
+		cout << "Arena bytes    : " << arena.used() << " (" << double(arena.used()) / nodeCount << " per node, discarded nodes included)" << endl;
+		cout << "Free time      : " << Measure([&] {
+			arenaTree.reset();
+			arena.release();
+		}) << "s" << endl;
+	}
+}
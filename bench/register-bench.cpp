@@ -0,0 +1,76 @@
+/*
+* Copyright 2019 PragmaTwice
+*/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include "chtholly.hpp"
+#include "chtholly/irgenerator.hpp"
+#include "chtholly/packedir.hpp"
+#include "chtholly/registerir.hpp"
+
+using namespace std;
+using namespace Chtholly;
+
+string MakeSource(size_t repeat)
+{
+	// only constructs which the IR generator supports
+	static const auto snippet = R"(var (a, c...) (1; [2.33, null, "s"]); const x [a, c]; [1, [2, [x]]], a)"s;
+
+	string source;
+	for (size_t i = 0; i < repeat; ++i)
+	{
+		if (i != 0) source += ";\n";
+		source += snippet;
+	}
+	return source;
+}
+
+template <typename F>
+double Measure(F&& f)
+{
+	const auto beginTime = chrono::system_clock::now();
+	f();
+	const auto endTime = chrono::system_clock::now();
+
+	return chrono::duration<double>(endTime - beginTime).count();
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t repeat = argc > 1 ? stoul(argv[1]) : 1000;
+	const auto source = MakeSource(repeat);
+
+	ParseTree tree;
+	Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+	const auto seq = IRGenerator::Generate(tree);
+
+	RegisterLowering::Result lowered;
+	const auto lowerTime = Measure([&] {
+		lowered = RegisterLowering::Lower(seq);
+	});
+
+	// the generated code is straight-line, so every instruction is dispatched once
+	size_t stackBytes = 0, registerBytes = 0, frameSize = 0, spillSize = 0;
+	for (const auto& instruction : seq) stackBytes += RegisterLowering::EncodedSize(instruction);
+	for (const auto& function : lowered.functions)
+	{
+		for (const auto& instruction : function.code) registerBytes += RegisterLowering::EncodedSize(instruction);
+		frameSize = max(frameSize, function.frameSize);
+		spillSize = max(spillSize, function.spillSize);
+	}
+
+	const auto stackCount = seq.size(), registerCount = lowered.instructionCount();
+
+	cout << "Source size     : " << source.size() << " bytes" << endl;
+	cout << "Stack code      : " << stackCount << " instructions, " << stackBytes << " bytes (" << stackCount * sizeof(PackedInstruction) << " packed)" << endl;
+	cout << "Register code   : " << registerCount << " instructions, " << registerBytes << " bytes" << endl;
+	cout << "Frame size      : " << frameSize << " registers, " << spillSize << " spill slots" << endl;
+	cout << endl;
+
+	cout << "Lowering time   : " << lowerTime << "s" << endl;
+	cout << "Dispatch ratio  : " << double(registerCount) / stackCount << endl;
+	cout << "Size ratio      : " << double(registerBytes) / stackBytes << endl;
+}
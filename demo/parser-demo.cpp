@@ -11,33 +11,6 @@
 using namespace std;
 using namespace Chtholly;
 
-string ToString (const ParseTree::Observer& v)
-{
-	string out;
-
-	const auto isTerm = v.value().type == ParseUnit::Type::term;
-
-	if (isTerm) out += '(';
-
-	if (isTerm)
-	{
-		out += v.value().name + ' ';
-	}
-	else
-	{
-		out += v.value().name + '[' + string(v.value().value) + "] ";
-	}
-
-	for (auto i = v.childrenBegin(); i != v.childrenEnd(); ++i)
-	{
-		out += ToString(i);
-	}
-
-	if (isTerm) out += ')';
-
-	return out;
-}
-
 void parseInputAndLog(const Parser::Info& info)
 {
 	const auto beginTime = chrono::system_clock::now();
@@ -45,7 +18,8 @@ void parseInputAndLog(const Parser::Info& info)
 	const auto endTime = chrono::system_clock::now();
 
 
-	cout << "Parse tree : " << ToString(info.second) << endl;
+	cout << "Parse tree : ";
+	WriteTree(cout, info.second) << endl;
 	auto trimIter = find_if(result.first.rbegin(), result.first.rend(), [](auto&& elem) { return !isspace(elem); });
 	result.first.remove_suffix(distance(result.first.rbegin(), trimIter));
 
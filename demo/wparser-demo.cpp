@@ -11,44 +11,6 @@
 using namespace std;
 using namespace Chtholly;
 
-wstring ToWString(const string& str)
-{
-	wstring result;
-	for(auto&& elem : str)
-	{
-		result += elem;
-	}
-
-	return result;
-}
-
-wstring ToWString(const BasicParseTree<wstring_view>::Observer& v)
-{
-	wstring out;
-
-	const auto isTerm = v.value().type == BasicParseUnit<wstring_view>::Type::term;
-
-	if (isTerm) out += L'(';
-
-	if (isTerm)
-	{
-		out += ToWString(v.value().name) + L' ';
-	}
-	else
-	{
-		out += ToWString(v.value().name) + L'[' + wstring(v.value().value) + L"] ";
-	}
-
-	for (auto i = v.childrenBegin(); i != v.childrenEnd(); ++i)
-	{
-		out += ToWString(i);
-	}
-
-	if (isTerm) out += ')';
-
-	return out;
-}
-
 void parseInputAndLog(const BasicParser<wstring_view>::Info& info)
 {
 	const auto beginTime = chrono::system_clock::now();
@@ -56,7 +18,8 @@ void parseInputAndLog(const BasicParser<wstring_view>::Info& info)
 	const auto endTime = chrono::system_clock::now();
 
 	
-	wcout << L"Parse tree : " << ToWString(info.second) << endl;
+	wcout << L"Parse tree : ";
+	WriteTree(wcout, info.second) << endl;
 	auto trimIter = find_if(result.first.rbegin(), result.first.rend(), [](auto&& elem) { return !iswspace(elem); });
 	result.first.remove_suffix(distance(result.first.rbegin(), trimIter));
 	
@@ -0,0 +1,169 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <type_traits>
+
+namespace Chtholly
+{
+	// A bump allocator: memory is handed out from large blocks and is only given back all at once
+	class MonotonicArena
+	{
+		struct Block
+		{
+			Block* next;
+		};
+
+		Block* blocks = nullptr;
+
+		char* cursor = nullptr;
+		char* limit = nullptr;
+
+		std::size_t nextBlockSize;
+		std::size_t usedBytes = 0;
+		std::size_t reservedBytes = 0;
+
+		static char* AlignUp(char* pointer, std::size_t alignment)
+		{
+			const auto address = reinterpret_cast<std::uintptr_t>(pointer);
+			return pointer + ((alignment - address % alignment) % alignment);
+		}
+
+		void grow(std::size_t minSize)
+		{
+			const auto size = std::max(nextBlockSize, minSize + sizeof(Block));
+
+			auto block = static_cast<Block*>(::operator new(size));
+			block->next = blocks;
+			blocks = block;
+
+			cursor = reinterpret_cast<char*>(block + 1);
+			limit = reinterpret_cast<char*>(block) + size;
+
+			reservedBytes += size;
+			nextBlockSize *= 2;
+		}
+
+	public:
+
+		explicit MonotonicArena(std::size_t initialBlockSize = 4096)
+			: nextBlockSize(initialBlockSize) {}
+
+		MonotonicArena(const MonotonicArena&) = delete;
+
+		MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+		void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+		{
+			auto aligned = AlignUp(cursor, alignment);
+			// aligning may step past the end of the block when its tail is not aligned
+			if (cursor == nullptr || aligned > limit || bytes > std::size_t(limit - aligned))
+			{
+				grow(bytes + alignment);
+				aligned = AlignUp(cursor, alignment);
+			}
+
+			cursor = aligned + bytes;
+			usedBytes += bytes;
+
+			return aligned;
+		}
+
+		// Give all blocks back at once, every pointer allocated from this arena becomes dangling
+		void release() noexcept
+		{
+			while (blocks)
+			{
+				auto next = blocks->next;
+				::operator delete(blocks);
+				blocks = next;
+			}
+
+			cursor = limit = nullptr;
+			usedBytes = reservedBytes = 0;
+		}
+
+		// bytes handed out by allocate
+		std::size_t used() const
+		{
+			return usedBytes;
+		}
+
+		// bytes obtained from the global allocator
+		std::size_t reserved() const
+		{
+			return reservedBytes;
+		}
+
+		~MonotonicArena()
+		{
+			release();
+		}
+	};
+
+	// Allocator adaptor for MonotonicArena: deallocation does nothing,
+	// the memory is reclaimed when the arena is released or destroyed
+	template <typename T>
+	class ArenaAllocator
+	{
+		MonotonicArena* arena;
+
+		template <typename U>
+		friend class ArenaAllocator;
+
+	public:
+
+		using value_type = T;
+
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+
+		ArenaAllocator(MonotonicArena& inArena) noexcept : arena(&inArena) {}
+
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U>& src) noexcept : arena(src.arena) {}
+
+		T* allocate(std::size_t n)
+		{
+			return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T*, std::size_t) noexcept {}
+
+		MonotonicArena& resource() const
+		{
+			return *arena;
+		}
+
+		template <typename U>
+		bool operator==(const ArenaAllocator<U>& other) const
+		{
+			return arena == other.arena;
+		}
+		template <typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const
+		{
+			return arena != other.arena;
+		}
+	};
+
+}
@@ -16,58 +16,47 @@
 
 #pragma once
 
-#include <map>
-#include <functional>
+#include <array>
+#include <cstddef>
 
 namespace Chtholly 
 {
 
-	template <typename State, typename Iterator>
-	struct FiniteAutomaton
+	// An automaton whose states are the enumerators 0 ... stateCount-1 of an enum,
+	// with a table of plain transition functions: it can be constexpr and runs without allocation.
+	// The data a run works on is passed to the transitions as a context.
+	template <typename State, std::size_t stateCount, typename Context, typename Iterator>
+	struct TableAutomaton
 	{
-		using StateRef = const State&;
+		using Transition = State(*)(Context&, Iterator);
 
-		using TransitionFunctionPerState = std::function<State(Iterator)>;
+		using TransitionTable = std::array<Transition, stateCount>;
 
-		using TransitionMap = std::map<State, TransitionFunctionPerState>;
+		State beginState;
+		State endState;
+		TransitionTable table;
 
-		using EndPredicate = std::function<bool(StateRef)>;
-
-		State state;
-		EndPredicate endPredicate;
-		TransitionMap map;
-
-		FiniteAutomaton(StateRef beginState, const EndPredicate& inEndPredicate, const TransitionMap& inMap)
-			: state(beginState), endPredicate(inEndPredicate), map(inMap)
-		{
-		}
-
-		FiniteAutomaton(StateRef beginState, StateRef endState, const TransitionMap& inMap)
-			: state(beginState), endPredicate([=](StateRef s) { return s == endState; }), map(inMap)
+		constexpr TableAutomaton(State inBeginState, State inEndState, const TransitionTable& inTable)
+			: beginState(inBeginState), endState(inEndState), table(inTable)
 		{
 		}
 
-		FiniteAutomaton(StateRef beginState, const TransitionMap& inMap)
-			: state(beginState), endPredicate([](StateRef) { return false; }), map(inMap)
+		// a single transition, for a run driven from outside
+		State step(Context& context, State state, Iterator iterator) const
 		{
+			return state == endState ? state : table[std::size_t(state)](context, iterator);
 		}
 
-		FiniteAutomaton(const FiniteAutomaton&) = default;
-
-		FiniteAutomaton& operator=(const FiniteAutomaton&) = default;
-
-		State operator()(Iterator begin, Iterator end)
+		State operator()(Context& context, Iterator begin, Iterator end) const
 		{
-			Iterator iterator = begin;
-			for (; !endPredicate(state) && iterator != end; ++iterator)
+			State state = beginState;
+			for (Iterator iterator = begin; state != endState && iterator != end; ++iterator)
 			{
-				state = map.at(state)(iterator);
+				state = table[std::size_t(state)](context, iterator);
 			}
 
 			return state;
 		}
-
-		~FiniteAutomaton() = default;
 	};
 
-}
\ No newline at end of file
+}
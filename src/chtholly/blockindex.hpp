@@ -0,0 +1,181 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "instruction.hpp"
+
+namespace Chtholly
+{
+	enum class BracketKind : std::uint8_t { none, block, function, object };
+
+	struct Bracket
+	{
+		BracketKind kind;
+		bool opening;
+	};
+
+	// The bracket an opcode forms in a flat sequence:
+	// a block begins with Block::Begin or NamedBegin and ends with Block::End, Drop or Function::Call,
+	// a function with Function::Begin and End, an object with Object::Begin and End or EndWithInit
+	constexpr Bracket BracketOf(OpcodeId code)
+	{
+		switch (code)
+		{
+		case OpcodeId::BlockBegin: case OpcodeId::BlockNamedBegin:
+			return { BracketKind::block, true };
+		case OpcodeId::BlockEnd: case OpcodeId::BlockDrop: case OpcodeId::FunctionCall:
+			return { BracketKind::block, false };
+		case OpcodeId::FunctionBegin:
+			return { BracketKind::function, true };
+		case OpcodeId::FunctionEnd:
+			return { BracketKind::function, false };
+		case OpcodeId::ObjectBegin:
+			return { BracketKind::object, true };
+		case OpcodeId::ObjectEnd: case OpcodeId::ObjectEndWithInit:
+			return { BracketKind::object, false };
+		default:
+			return { BracketKind::none, false };
+		}
+	}
+
+	// Side index of the brackets of a sequence: the partner of each bracket instruction
+	// and the nesting depth of every instruction, so that skipping a body is O(1).
+	// It is built incrementally, one opcode at a time, so a generator can fill it while emitting.
+	class BlockIndex
+	{
+	public:
+
+		using Index = std::uint32_t;
+		using Size = std::size_t;
+
+		inline static constexpr Index npos = std::numeric_limits<Index>::max();
+
+	private:
+
+		struct Open
+		{
+			Index index;
+			BracketKind kind;
+		};
+
+		std::vector<Index> partners;
+		std::vector<Index> depths;
+		std::vector<Open> open;
+
+		[[noreturn]] static void Fail(const std::string& reason, Size index)
+		{
+			throw std::invalid_argument("BlockIndex: " + reason + " at instruction " + std::to_string(index));
+		}
+
+	public:
+
+		BlockIndex() = default;
+
+		template <typename V>
+		static BlockIndex Build(const std::vector<BasicInstruction<V>>& seq)
+		{
+			BlockIndex index;
+			index.reserve(seq.size());
+			for (const auto& instruction : seq)
+			{
+				index.append(instruction.opcode());
+			}
+			index.finish();
+			return index;
+		}
+
+		void reserve(Size size)
+		{
+			partners.reserve(size);
+			depths.reserve(size);
+		}
+
+		// index the next instruction of the sequence
+		void append(OpcodeId code)
+		{
+			const auto index = partners.size();
+			if (index >= npos) Fail("too many instructions", index);
+
+			const auto bracket = BracketOf(code);
+
+			if (bracket.kind != BracketKind::none && !bracket.opening)
+			{
+				if (open.empty()) Fail("unmatched closing bracket", index);
+				if (open.back().kind != bracket.kind) Fail("mismatched closing bracket", index);
+
+				partners[open.back().index] = Index(index);
+				partners.push_back(open.back().index);
+				open.pop_back();
+				depths.push_back(Index(open.size()));
+				return;
+			}
+
+			partners.push_back(npos);
+			depths.push_back(Index(open.size()));
+
+			if (bracket.kind != BracketKind::none)
+			{
+				open.push_back({ Index(index), bracket.kind });
+			}
+		}
+
+		// check that every bracket is closed
+		void finish() const
+		{
+			if (!open.empty()) Fail("unclosed bracket", open.back().index);
+		}
+
+		// the matching bracket of a bracket instruction, npos for other instructions
+		Index partner(Size index) const
+		{
+			return partners.at(index);
+		}
+
+		// number of brackets enclosing an instruction; a bracket pair is at the depth of its parent's content
+		Index depth(Size index) const
+		{
+			return depths.at(index);
+		}
+
+		// the instruction following the bracket pair opened (or closed) at index
+		Index skip(Size index) const
+		{
+			const auto other = partner(index);
+			if (other == npos) Fail("not a bracket", index);
+
+			return (other > index ? other : Index(index)) + 1;
+		}
+
+		bool complete() const
+		{
+			return open.empty();
+		}
+
+		Size size() const
+		{
+			return partners.size();
+		}
+
+		~BlockIndex() = default;
+	};
+}
@@ -0,0 +1,288 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "packedir.hpp"
+#include "mappedfile.hpp"
+
+namespace Chtholly
+{
+	// Binary bytecode module, in native byte order:
+	//   Header
+	//   PackedInstruction code[instructionCount]
+	//   int64_t ints[intCount]                            integer pool
+	//   double floats[floatCount]                         float pool
+	//   uint32_t spellingOffsets[symbolCount+stringCount+1] offsets in the spellings, symbols first
+	//   uint32_t sourceMap[sourceMapSize]                 source offset of each instruction, if present
+	//   char spellings[spellingBytes]
+	namespace BytecodeImage
+	{
+		using Index = std::uint32_t;
+
+		inline constexpr Index npos = std::numeric_limits<Index>::max();
+
+		inline constexpr std::uint32_t magic = 0x4D424343; // "CCBM"
+		inline constexpr std::uint32_t version = 1;
+
+		struct Header
+		{
+			std::uint32_t magic;
+			std::uint32_t version;
+			std::uint32_t opcodeCount;	// opcodes known to the writer
+			std::uint32_t instructionCount;
+			std::uint32_t intCount;
+			std::uint32_t floatCount;
+			std::uint32_t symbolCount;
+			std::uint32_t stringCount;
+			std::uint32_t sourceMapSize;	// 0 or instructionCount
+			std::uint32_t spellingBytes;
+		};
+
+		static_assert(sizeof(Header) % alignof(PackedInstruction) == 0);
+
+		// Write a packed sequence; sourceMap is either empty or holds one source offset (or npos) per instruction
+		inline void Write(std::ostream& out, const PackedSequence& seq, const std::vector<std::uint32_t>& sourceMap = {})
+		{
+			if (!sourceMap.empty() && sourceMap.size() != seq.size())
+			{
+				throw std::invalid_argument("BytecodeImage::Write: source map doesn't match the code");
+			}
+
+			const auto& pool = seq.constants();
+			const auto& symbols = seq.symbols();
+
+			std::vector<std::uint32_t> spellingOffsets{ 0 };
+			std::string spellings;
+			auto addSpelling = [&](std::string_view spelling)
+			{
+				spellings += spelling;
+				if (spellings.size() > std::numeric_limits<std::uint32_t>::max())
+				{
+					throw std::length_error("BytecodeImage::Write: module too large");
+				}
+				spellingOffsets.push_back(std::uint32_t(spellings.size()));
+			};
+
+			for (SymbolId i = 0; i < symbols.size(); ++i) addSpelling(symbols.name(i));
+			for (Index i = 0; i < pool.stringCount(); ++i) addSpelling(pool.string(i));
+
+			std::vector<IRValue::Int> ints;
+			for (Index i = 0; i < pool.intCount(); ++i) ints.push_back(pool.integer(i));
+
+			std::vector<IRValue::Float> floats;
+			for (Index i = 0; i < pool.floatCount(); ++i) floats.push_back(pool.floating(i));
+
+			const Header header{ magic, version, std::uint32_t(opcodeCount), std::uint32_t(seq.size()),
+				std::uint32_t(ints.size()), std::uint32_t(floats.size()),
+				std::uint32_t(symbols.size()), std::uint32_t(pool.stringCount()),
+				std::uint32_t(sourceMap.size()), std::uint32_t(spellings.size()) };
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(seq.instructions().data()), seq.size() * sizeof(PackedInstruction));
+			out.write(reinterpret_cast<const char*>(ints.data()), ints.size() * sizeof(IRValue::Int));
+			out.write(reinterpret_cast<const char*>(floats.data()), floats.size() * sizeof(IRValue::Float));
+			out.write(reinterpret_cast<const char*>(spellingOffsets.data()), spellingOffsets.size() * sizeof(std::uint32_t));
+			out.write(reinterpret_cast<const char*>(sourceMap.data()), sourceMap.size() * sizeof(std::uint32_t));
+			out.write(spellings.data(), spellings.size());
+		}
+	}
+
+	// A read-only bytecode module reading its instructions and constants in place.
+	// The image is either a caller-owned buffer or a mapped file owned by the module.
+	class BytecodeModule : public BasicPackedReader<BytecodeModule, IRValue>
+	{
+	public:
+
+		using Index = BytecodeImage::Index;
+
+		inline static constexpr Index npos = BytecodeImage::npos;
+
+	private:
+
+		using Header = BytecodeImage::Header;
+
+		MappedFile file;
+
+		Header header{};
+
+		const PackedInstruction* code = nullptr;
+		const Int* ints = nullptr;
+		const Float* floats = nullptr;
+		const std::uint32_t* spellingOffsets = nullptr;
+		const std::uint32_t* sourceMap = nullptr;
+		const char* spellings = nullptr;
+
+		[[noreturn]] static void Fail(const char* reason)
+		{
+			throw std::runtime_error(std::string("BytecodeModule: ") + reason);
+		}
+
+		void load(const char* data, Size size)
+		{
+			if (size < sizeof(Header)) Fail("truncated header");
+			if (reinterpret_cast<std::uintptr_t>(data) % alignof(PackedInstruction) != 0) Fail("misaligned image");
+
+			std::memcpy(&header, data, sizeof(Header));
+
+			if (header.magic != BytecodeImage::magic) Fail("bad magic number");
+			if (header.version != BytecodeImage::version) Fail("unsupported version");
+			if (header.opcodeCount > opcodeCount) Fail("unknown opcodes");
+			if (header.sourceMapSize != 0 && header.sourceMapSize != header.instructionCount) Fail("bad source map");
+
+			const Size spellingCount = Size(header.symbolCount) + header.stringCount;
+
+			const auto codeOffset = sizeof(Header);
+			const auto intsOffset = codeOffset + Size(header.instructionCount) * sizeof(PackedInstruction);
+			const auto floatsOffset = intsOffset + Size(header.intCount) * sizeof(Int);
+			const auto offsetsOffset = floatsOffset + Size(header.floatCount) * sizeof(Float);
+			const auto sourceMapOffset = offsetsOffset + (spellingCount + 1) * sizeof(std::uint32_t);
+			const auto spellingsOffset = sourceMapOffset + Size(header.sourceMapSize) * sizeof(std::uint32_t);
+			if (spellingsOffset + header.spellingBytes > size) Fail("truncated image");
+
+			code = reinterpret_cast<const PackedInstruction*>(data + codeOffset);
+			ints = reinterpret_cast<const Int*>(data + intsOffset);
+			floats = reinterpret_cast<const Float*>(data + floatsOffset);
+			spellingOffsets = reinterpret_cast<const std::uint32_t*>(data + offsetsOffset);
+			sourceMap = header.sourceMapSize ? reinterpret_cast<const std::uint32_t*>(data + sourceMapOffset) : nullptr;
+			spellings = data + spellingsOffset;
+
+			if (spellingOffsets[0] != 0) Fail("bad spelling table");
+			for (Size i = 0; i < spellingCount; ++i)
+			{
+				if (spellingOffsets[i] > spellingOffsets[i + 1] || spellingOffsets[i + 1] > header.spellingBytes) Fail("bad spelling table");
+			}
+
+			// validate the operands once, so that reading them doesn't need any check
+			auto checkSlot = [&](OperandKind kind, std::uint64_t slot, bool wide)
+			{
+				switch (kind)
+				{
+				case OperandKind::undef: case OperandKind::null: case OperandKind::integer:
+					return true;
+				case OperandKind::boolean: return slot <= 1;
+				case OperandKind::integerPool: return slot < header.intCount;
+				case OperandKind::floating: return wide;
+				case OperandKind::floatingPool: return slot < header.floatCount;
+				case OperandKind::string: return slot < header.stringCount;
+				case OperandKind::symbol: return slot < header.symbolCount;
+				default: return false;
+				}
+			};
+
+			for (Index i = 0; i < header.instructionCount; ++i)
+			{
+				const auto& packed = code[i];
+
+				if (Size(packed.opcode) >= header.opcodeCount) Fail("bad opcode");
+				if (packed.size > PackedInstruction::maxOprands) Fail("bad operand count");
+
+				if (packed.size > 0 ? !checkSlot(packed.kinds[0], packed.first, true) : packed.kinds[0] != OperandKind::none) Fail("bad operand");
+				if (packed.size > 1 ? !checkSlot(packed.kinds[1], packed.second, false) : packed.kinds[1] != OperandKind::none) Fail("bad operand");
+			}
+		}
+
+	public:
+
+		// View a buffer holding a module, which has to outlive the view
+		BytecodeModule(const void* data, Size size)
+		{
+			load(static_cast<const char*>(data), size);
+		}
+
+		// Map a module file, owned by the view
+		explicit BytecodeModule(const std::string& path) : file(path)
+		{
+			load(file.data(), file.size());
+		}
+
+		BytecodeModule(const BytecodeModule&) = delete;
+
+		BytecodeModule& operator=(const BytecodeModule&) = delete;
+
+		const PackedInstruction& operator[](Size index) const
+		{
+			return code[index];
+		}
+
+		const PackedInstruction* begin() const
+		{
+			return code;
+		}
+
+		const PackedInstruction* end() const
+		{
+			return code + header.instructionCount;
+		}
+
+		Size size() const
+		{
+			return header.instructionCount;
+		}
+
+		Int integer(Index index) const
+		{
+			return ints[index];
+		}
+
+		Float floating(Index index) const
+		{
+			return floats[index];
+		}
+
+		StringView symbol(SymbolId id) const
+		{
+			return { spellings + spellingOffsets[id], spellingOffsets[id + 1] - spellingOffsets[id] };
+		}
+
+		StringView string(Index index) const
+		{
+			return symbol(header.symbolCount + index);
+		}
+
+		Size symbolCount() const
+		{
+			return header.symbolCount;
+		}
+
+		Size stringCount() const
+		{
+			return header.stringCount;
+		}
+
+		bool hasSourceMap() const
+		{
+			return sourceMap != nullptr;
+		}
+
+		// source offset of an instruction, npos if unknown
+		Index sourceOffset(Size index) const
+		{
+			return sourceMap ? sourceMap[index] : npos;
+		}
+
+		~BytecodeModule() = default;
+	};
+}
@@ -0,0 +1,648 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "instruction.hpp"
+#include "blockindex.hpp"
+
+namespace Chtholly
+{
+	// Control-flow graph of an instruction sequence (or of the body of a function in it),
+	// with the operand stack turned into SSA values and the dominator tree of the basic blocks.
+	//
+	// Basic blocks start at the first instruction, at every Control::Mark or target of a linked jump,
+	// and after every jump. Function bodies are opaque: Function::Begin defines one value and the body
+	// is skipped, its own graph being built from the range of the body.
+	//
+	// Stack simulation: Block::Begin, NamedBegin and Object::Begin open a frame; Function::Call,
+	// Object::End and EndWithInit pop their frame into a new value. The generator wraps every element of
+	// a multi-valued expression in a block closed by Block::End, or by Block::Drop when a ',' follows it:
+	// Block::End leaves all the values of its frame in the enclosing one (a new undef value if it is empty),
+	// Block::Drop discards them but the declarations, which are elements of the pattern around them.
+	// Literals, Object::Use, declarations and List::Pop push a new value, declarations with a constraint,
+	// Object::AttachTo and List::Push consume one and conditional jumps consume their condition.
+	// Where control flow joins, a value slot of the stack on which the predecessors disagree gets a phi;
+	// at a loop header every value slot gets one, as the values of the back edges are not known yet.
+	template <typename V>
+	class BasicControlFlowGraph
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+		using Sequence = std::vector<Instruction>;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+
+		using Index = std::uint32_t;
+		using Size = std::size_t;
+
+		inline static constexpr Index npos = std::numeric_limits<Index>::max();
+
+		struct Block
+		{
+			Index begin;	// instruction range
+			Index end;
+
+			std::vector<Index> successors;
+			std::vector<Index> predecessors;
+
+			std::vector<Index> phis;	// SSA values defined on entry
+		};
+
+		enum class ValueKind : std::uint8_t
+		{
+			instruction,	// defined by the instruction at SSAValue::instruction
+			phi,	// one operand per predecessor of SSAValue::block, npos for an unreachable one
+			undef	// value of an empty block, left by the Block::End at SSAValue::instruction
+		};
+
+		struct SSAValue
+		{
+			ValueKind kind;
+			Index block;
+			Index instruction;
+			std::vector<Index> operands;	// for phis only
+		};
+
+		// what an instruction takes from and leaves on the stack
+		struct Operation
+		{
+			std::vector<Index> operands;
+			Index result = npos;
+		};
+
+	private:
+
+		Index rangeBegin = 0;
+		Index rangeEnd = 0;
+
+		std::vector<Block> _blocks;
+		std::vector<SSAValue> _values;
+		std::vector<Operation> operations;
+		std::vector<Index> order;	// reverse post-order of the reachable blocks
+		std::vector<Index> idoms;
+		std::vector<Index> _results;
+
+		// value slots of the stack, frames as npos entries tagged with the bracket they belong to
+		struct Slot
+		{
+			Index value;
+			BracketKind frame;
+		};
+
+		using Stack = std::vector<Slot>;
+
+		[[noreturn]] static void Fail(const std::string& reason, Size index)
+		{
+			throw std::invalid_argument("ControlFlowGraph: " + reason + " at instruction " + std::to_string(index));
+		}
+
+		static bool IsJump(OpcodeId code)
+		{
+			switch (code)
+			{
+			case OpcodeId::ControlJump: case OpcodeId::ControlJumpIf: case OpcodeId::ControlJumpIfElse:
+			case OpcodeId::ControlJumpTo: case OpcodeId::ControlJumpIfTo: case OpcodeId::ControlJumpIfElseTo:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		static bool IsDeclaration(OpcodeId code)
+		{
+			switch (code)
+			{
+			case OpcodeId::ObjectVar: case OpcodeId::ObjectVarWithConstraint: case OpcodeId::ObjectVarPack: case OpcodeId::ObjectVarPackWithConstraint:
+			case OpcodeId::ObjectConst: case OpcodeId::ObjectConstWithConstraint: case OpcodeId::ObjectConstPack: case OpcodeId::ObjectConstPackWithConstraint:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		Index newValue(ValueKind kind, Index block, Index instruction)
+		{
+			_values.push_back({ kind, block, instruction, {} });
+			return Index(_values.size() - 1);
+		}
+
+		void buildBlocks(const Sequence& seq, const BlockIndex& brackets)
+		{
+			std::vector<bool> leaders(rangeEnd - rangeBegin + 1, false);
+			std::unordered_map<String, Index> marks;
+
+			// the bodies of functions are skipped, and may not be jumped into
+			std::vector<bool> inBody(rangeEnd - rangeBegin + 1, false);
+			std::vector<std::pair<Index, Index>> jumps;	// target and jump
+
+			auto lead = [&](Int target, Index at)
+			{
+				if (target < rangeBegin || target > rangeEnd) Fail("jump out of the range", at);
+				leaders[Index(target) - rangeBegin] = true;
+				jumps.push_back({ Index(target), at });
+			};
+
+			leaders[0] = true;
+			for (Index i = rangeBegin; i < rangeEnd; ++i)
+			{
+				const auto& instruction = seq[i];
+				const auto code = instruction.opcode();
+
+				if (code == OpcodeId::FunctionBegin)
+				{
+					const auto end = brackets.partner(i);
+					if (end >= rangeEnd) Fail("function body past the end of the range", i);
+					std::fill(inBody.begin() + (i + 1 - rangeBegin), inBody.begin() + (end + 1 - rangeBegin), true);
+					i = end;
+					continue;
+				}
+
+				if (code == OpcodeId::ControlMark)
+				{
+					if (!marks.emplace(std::get<String>(instruction.oprands()[0]), i).second) Fail("duplicate tag", i);
+					leaders[i - rangeBegin] = true;
+				}
+				else if (IsJump(code))
+				{
+					leaders[i + 1 - rangeBegin] = true;
+					if (code == OpcodeId::ControlJumpTo || code == OpcodeId::ControlJumpIfTo || code == OpcodeId::ControlJumpIfElseTo)
+					{
+						for (const auto& target : instruction.oprands()) lead(std::get<Int>(target), i);
+					}
+				}
+			}
+
+			for (const auto& [target, at] : jumps)
+			{
+				if (inBody[target - rangeBegin]) Fail("jump into a function body", at);
+			}
+
+			std::vector<Index> blockAt(rangeEnd - rangeBegin + 1, npos);
+			for (Index i = rangeBegin; i < rangeEnd; ++i)
+			{
+				if (!leaders[i - rangeBegin]) continue;
+
+				if (!_blocks.empty()) _blocks.back().end = i;
+				blockAt[i - rangeBegin] = Index(_blocks.size());
+				_blocks.push_back({ i, rangeEnd, {}, {}, {} });
+			}
+
+			// a jump to the end of the range goes to an empty exit block
+			auto blockOf = [&](Index target) -> Index
+			{
+				if (blockAt[target - rangeBegin] == npos)
+				{
+					blockAt[target - rangeBegin] = Index(_blocks.size());
+					_blocks.push_back({ target, target, {}, {}, {} });
+				}
+				return blockAt[target - rangeBegin];
+			};
+
+			auto resolve = [&](const Value& tag, Index at) -> Index
+			{
+				auto found = marks.find(std::get<String>(tag));
+				if (found == marks.end()) Fail("missing tag", at);
+				return blockOf(found->second);
+			};
+
+			const auto count = _blocks.size();
+			for (Index b = 0; b < count; ++b)
+			{
+				// blockOf may grow the blocks, so the successors are set once they are known
+				std::vector<Index> successors;
+				const auto next = _blocks[b].end;
+
+				// a trailing function body ends with Function::End, which is not a jump
+				const auto last = next == _blocks[b].begin ? npos : next - 1;
+
+				const auto code = last == npos ? OpcodeId::None : seq[last].opcode();
+				const auto& oprands = last == npos ? std::vector<Value>{} : seq[last].oprands();
+
+				switch (code)
+				{
+				case OpcodeId::ControlJump:
+					successors = { resolve(oprands[0], last) };
+					break;
+				case OpcodeId::ControlJumpIf:
+					successors = { resolve(oprands[0], last), blockOf(next) };
+					break;
+				case OpcodeId::ControlJumpIfElse:
+					successors = { resolve(oprands[0], last), resolve(oprands[1], last) };
+					break;
+				case OpcodeId::ControlJumpTo:
+					successors = { blockOf(Index(std::get<Int>(oprands[0]))) };
+					break;
+				case OpcodeId::ControlJumpIfTo:
+					successors = { blockOf(Index(std::get<Int>(oprands[0]))), blockOf(next) };
+					break;
+				case OpcodeId::ControlJumpIfElseTo:
+					successors = { blockOf(Index(std::get<Int>(oprands[0]))), blockOf(Index(std::get<Int>(oprands[1]))) };
+					break;
+				default:
+					// the last block falls through to the exit block, if a jump made one
+					if (next < rangeEnd || blockAt[next - rangeBegin] != npos) successors = { blockOf(next) };
+				}
+
+				_blocks[b].successors = std::move(successors);
+			}
+
+			for (Index b = 0; b < _blocks.size(); ++b)
+			{
+				for (auto s : _blocks[b].successors) _blocks[s].predecessors.push_back(b);
+			}
+		}
+
+		void buildOrder()
+		{
+			std::vector<bool> visited(_blocks.size(), false);
+			std::vector<std::pair<Index, Size>> pending{ { 0, 0 } };
+			visited[0] = true;
+
+			while (!pending.empty())
+			{
+				auto& [block, next] = pending.back();
+				if (next < _blocks[block].successors.size())
+				{
+					const auto successor = _blocks[block].successors[next++];
+					if (!visited[successor])
+					{
+						visited[successor] = true;
+						pending.push_back({ successor, 0 });
+					}
+				}
+				else
+				{
+					order.push_back(block);
+					pending.pop_back();
+				}
+			}
+
+			std::reverse(order.begin(), order.end());
+		}
+
+		void simulate(const Sequence& seq, const BlockIndex& brackets, Index block, Stack& stack)
+		{
+			auto pop = [&](Index at) -> Index
+			{
+				if (stack.empty() || stack.back().value == npos) Fail("stack underflow", at);
+				const auto value = stack.back().value;
+				stack.pop_back();
+				return value;
+			};
+
+			auto popFrame = [&](BracketKind kind, Index at) -> std::vector<Index>
+			{
+				std::vector<Index> frame;
+				while (!stack.empty() && stack.back().value != npos)
+				{
+					frame.push_back(stack.back().value);
+					stack.pop_back();
+				}
+				if (stack.empty() || stack.back().frame != kind) Fail("unbalanced frame", at);
+				stack.pop_back();
+
+				std::reverse(frame.begin(), frame.end());
+				return frame;
+			};
+
+			auto push = [&](Index at) -> Index
+			{
+				const auto value = newValue(ValueKind::instruction, block, at);
+				stack.push_back({ value, BracketKind::none });
+				return value;
+			};
+
+			for (Index i = _blocks[block].begin; i < _blocks[block].end; ++i)
+			{
+				auto& operation = operations[i - rangeBegin];
+
+				switch (seq[i].opcode())
+				{
+				case OpcodeId::BlockBegin: case OpcodeId::BlockNamedBegin:
+					stack.push_back({ npos, BracketKind::block });
+					break;
+				case OpcodeId::ObjectBegin:
+					stack.push_back({ npos, BracketKind::object });
+					break;
+
+				case OpcodeId::BlockEnd:
+					operation.operands = popFrame(BracketKind::block, i);
+					if (operation.operands.empty())
+					{
+						operation.result = newValue(ValueKind::undef, block, i);
+						stack.push_back({ operation.result, BracketKind::none });
+					}
+					for (auto value : operation.operands) stack.push_back({ value, BracketKind::none });
+					break;
+				case OpcodeId::BlockDrop:
+					operation.operands = popFrame(BracketKind::block, i);
+					for (auto value : operation.operands)
+					{
+						const auto& defined = _values[value];
+						if (defined.kind == ValueKind::instruction && IsDeclaration(seq[defined.instruction].opcode())) stack.push_back({ value, BracketKind::none });
+					}
+					break;
+				case OpcodeId::FunctionCall:
+					operation.operands = popFrame(BracketKind::block, i);
+					operation.result = push(i);
+					break;
+				case OpcodeId::ObjectEnd: case OpcodeId::ObjectEndWithInit:
+					operation.operands = popFrame(BracketKind::object, i);
+					operation.result = push(i);
+					break;
+
+				case OpcodeId::FunctionBegin:
+					operation.result = push(i);
+					i = brackets.partner(i);
+					break;
+
+				case OpcodeId::ObjectVarWithConstraint: case OpcodeId::ObjectVarPackWithConstraint:
+				case OpcodeId::ObjectConstWithConstraint: case OpcodeId::ObjectConstPackWithConstraint:
+				case OpcodeId::ObjectAttachTo:
+					operation.operands = { pop(i) };
+					operation.result = push(i);
+					break;
+
+				case OpcodeId::ListPush:
+				case OpcodeId::ControlJumpIf: case OpcodeId::ControlJumpIfElse:
+				case OpcodeId::ControlJumpIfTo: case OpcodeId::ControlJumpIfElseTo:
+					operation.operands = { pop(i) };
+					break;
+
+				case OpcodeId::None: case OpcodeId::ControlMark:
+				case OpcodeId::ControlJump: case OpcodeId::ControlJumpTo:
+					break;
+
+				default:
+					operation.result = push(i);
+				}
+			}
+		}
+
+		void buildValues(const Sequence& seq, const BlockIndex& brackets)
+		{
+			operations.resize(rangeEnd - rangeBegin);
+
+			std::vector<Stack> exits(_blocks.size());
+			std::vector<bool> done(_blocks.size(), false);
+			std::vector<std::vector<Size>> phiSlots(_blocks.size());	// stack positions of the phis of each block
+
+			auto check = [&](const Stack& exit, const Stack& entry, Index block)
+			{
+				if (exit.size() != entry.size()) Fail("stack depth differs between predecessors", _blocks[block].begin);
+				for (Size s = 0; s < exit.size(); ++s)
+				{
+					if ((exit[s].value == npos) != (entry[s].value == npos) || exit[s].frame != entry[s].frame) Fail("frames differ between predecessors", _blocks[block].begin);
+				}
+			};
+
+			for (auto block : order)
+			{
+				Stack stack;
+
+				const auto& predecessors = _blocks[block].predecessors;
+				if (block != 0)
+				{
+					// the shape from a finished predecessor (the one before this block in the order at least)
+					Size first = 0;
+					while (!done[predecessors[first]]) ++first;
+					stack = exits[predecessors[first]];
+
+					const bool acyclic = std::all_of(predecessors.begin(), predecessors.end(), [&](Index p) { return done[p]; });
+
+					// a slot gets a phi unless every predecessor is finished and agrees on it
+					for (Size s = 0; s < stack.size() && predecessors.size() > 1; ++s)
+					{
+						if (stack[s].value == npos) continue;
+
+						const bool same = acyclic && std::all_of(predecessors.begin(), predecessors.end(), [&](Index p)
+						{
+							return exits[p].size() == stack.size() && exits[p][s].value == stack[s].value;
+						});
+						if (same) continue;
+
+						stack[s].value = newValue(ValueKind::phi, block, _blocks[block].begin);
+						_values[stack[s].value].operands.assign(predecessors.size(), npos);
+						_blocks[block].phis.push_back(stack[s].value);
+						phiSlots[block].push_back(s);
+					}
+				}
+
+				simulate(seq, brackets, block, stack);
+
+				exits[block] = std::move(stack);
+				done[block] = true;
+			}
+
+			// the block reaching the end of the range leaves the results
+			for (auto block : order)
+			{
+				if (_blocks[block].end != rangeEnd || !_blocks[block].successors.empty()) continue;
+
+				for (const auto& slot : exits[block])
+				{
+					if (slot.value != npos) _results.push_back(slot.value);
+				}
+			}
+
+			// fill the phis once every predecessor is finished, checking that the stacks agree
+			for (auto block : order)
+			{
+				const auto& predecessors = _blocks[block].predecessors;
+
+				Stack entry;
+				if (block != 0)
+				{
+					entry = exits[*std::find_if(predecessors.begin(), predecessors.end(), [&](Index p) { return done[p]; })];
+				}
+
+				for (Size k = 0; k < predecessors.size(); ++k)
+				{
+					const auto p = predecessors[k];
+					if (!done[p]) continue;
+
+					// the entry starts with an empty stack, so must every loop back to it
+					check(exits[p], entry, block);
+
+					for (Size phi = 0; phi < phiSlots[block].size(); ++phi)
+					{
+						_values[_blocks[block].phis[phi]].operands[k] = exits[p][phiSlots[block][phi]].value;
+					}
+				}
+			}
+		}
+
+		void buildDominators()
+		{
+			std::vector<Index> position(_blocks.size(), npos);
+			for (Index i = 0; i < order.size(); ++i) position[order[i]] = i;
+
+			idoms.assign(_blocks.size(), npos);
+			idoms[0] = 0;
+
+			auto intersect = [&](Index a, Index b)
+			{
+				while (a != b)
+				{
+					while (position[a] > position[b]) a = idoms[a];
+					while (position[b] > position[a]) b = idoms[b];
+				}
+				return a;
+			};
+
+			for (bool changed = true; changed;)
+			{
+				changed = false;
+				for (Size i = 1; i < order.size(); ++i)
+				{
+					const auto block = order[i];
+
+					Index idom = npos;
+					for (auto p : _blocks[block].predecessors)
+					{
+						if (idoms[p] == npos) continue;
+						idom = idom == npos ? p : intersect(p, idom);
+					}
+
+					if (idoms[block] != idom)
+					{
+						idoms[block] = idom;
+						changed = true;
+					}
+				}
+			}
+		}
+
+		BasicControlFlowGraph() = default;
+
+	public:
+
+		// graph of the instructions in [begin, end), e.g. the body of a Function::Begin at f: [f + 1, partner of f),
+		// given the block index of the whole sequence so that the graphs of its functions can share it
+		static BasicControlFlowGraph Build(const Sequence& seq, const BlockIndex& brackets, Size begin, Size end)
+		{
+			if (begin > end || end > seq.size() || end >= npos || brackets.size() != seq.size()) throw std::out_of_range("ControlFlowGraph: bad range");
+
+			BasicControlFlowGraph graph;
+			graph.rangeBegin = Index(begin);
+			graph.rangeEnd = Index(end);
+
+			if (begin == end)
+			{
+				graph._blocks.push_back({ Index(begin), Index(end), {}, {}, {} });
+			}
+			else
+			{
+				graph.buildBlocks(seq, brackets);
+			}
+
+			graph.buildOrder();
+			graph.buildValues(seq, brackets);
+			graph.buildDominators();
+
+			return graph;
+		}
+
+		static BasicControlFlowGraph Build(const Sequence& seq, Size begin, Size end)
+		{
+			return Build(seq, BlockIndex::Build(seq), begin, end);
+		}
+
+		static BasicControlFlowGraph Build(const Sequence& seq)
+		{
+			return Build(seq, 0, seq.size());
+		}
+
+		// block 0 is the entry
+		const std::vector<Block>& blocks() const
+		{
+			return _blocks;
+		}
+
+		const std::vector<SSAValue>& values() const
+		{
+			return _values;
+		}
+
+		// the stack effect of an instruction, by its index in the sequence
+		const Operation& operation(Size instruction) const
+		{
+			return operations.at(instruction - rangeBegin);
+		}
+
+		// the values left on the stack at the end of the range, none if it is unreachable
+		const std::vector<Index>& results() const
+		{
+			return _results;
+		}
+
+		// the reachable blocks in reverse post-order
+		const std::vector<Index>& reversePostOrder() const
+		{
+			return order;
+		}
+
+		bool reachable(Index block) const
+		{
+			return idoms[block] != npos;
+		}
+
+		// immediate dominator of a block, the entry for itself, npos for an unreachable block
+		Index idom(Index block) const
+		{
+			return idoms.at(block);
+		}
+
+		bool dominates(Index a, Index b) const
+		{
+			if (!reachable(a) || !reachable(b)) return false;
+
+			for (;; b = idoms[b])
+			{
+				if (a == b) return true;
+				if (b == 0) return false;
+			}
+		}
+
+		// children of every block in the dominator tree
+		std::vector<std::vector<Index>> dominatorTree() const
+		{
+			std::vector<std::vector<Index>> children(_blocks.size());
+			for (auto block : order)
+			{
+				if (block != 0) children[idoms[block]].push_back(block);
+			}
+			return children;
+		}
+
+		~BasicControlFlowGraph() = default;
+	};
+
+	using ControlFlowGraph = BasicControlFlowGraph<IRValue>;
+}
@@ -0,0 +1,316 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "parsetree.hpp"
+
+namespace Chtholly
+{
+	// An immutable tree whose nodes are stored contiguously in pre-order,
+	// linked by 32-bit indices instead of list iterators.
+	// Node 0 is a hidden node which holds the root, just like the "unused" node of BasicTree.
+	template <typename inValueType>
+	class BasicFlatTree
+	{
+	public:
+
+		using ValueType = inValueType;
+
+		using Index = std::uint32_t;
+		using Size = std::size_t;
+
+		inline static constexpr Index npos = std::numeric_limits<Index>::max();
+
+	protected:
+
+		struct Node
+		{
+			ValueType value;
+
+			Index parent;
+			Index firstChild = npos;
+			Index lastChild = npos;
+			Index prevSibling = npos;
+			Index nextSibling = npos;
+
+			Node(const ValueType& inValue, Index inParent)
+				: value(inValue), parent(inParent) {}
+		};
+
+		std::vector<Node> nodes;
+
+		template <typename SourceObserver>
+		static Size Count(const SourceObserver& src)
+		{
+			Size count = 0;
+			std::vector<SourceObserver> pending{ src };
+
+			while (!pending.empty())
+			{
+				const auto current = pending.back();
+				pending.pop_back();
+				++count;
+
+				for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child)
+				{
+					pending.push_back(child);
+				}
+			}
+
+			return count;
+		}
+
+		template <typename SourceObserver>
+		void build(const SourceObserver& src)
+		{
+			// the nodes are counted first so that they take exactly the storage they need
+			nodes.reserve(nodes.size() + Count(src));
+
+			// pairs of (source node, index of its parent in nodes)
+			std::vector<std::pair<SourceObserver, Index>> pending{ { src, 0 } };
+
+			while (!pending.empty())
+			{
+				auto [current, parentIndex] = pending.back();
+				pending.pop_back();
+
+				const auto index = static_cast<Index>(nodes.size());
+				nodes.emplace_back(current.value(), parentIndex);
+
+				auto& parent = nodes[parentIndex];
+				if (parent.lastChild == npos)
+				{
+					parent.firstChild = index;
+				}
+				else
+				{
+					nodes[parent.lastChild].nextSibling = index;
+					nodes.back().prevSibling = parent.lastChild;
+				}
+				parent.lastChild = index;
+
+				// push in reverse order so that children are visited (and stored) left to right
+				for (auto child = current.childrenEnd(); child != current.childrenBegin();)
+				{
+					pending.emplace_back(--child, index);
+				}
+			}
+		}
+
+	public:
+
+		class Observer
+		{
+		protected:
+
+			const BasicFlatTree* tree = nullptr;
+
+			Index parentIndex = npos;
+			Index nodeIndex = npos;
+
+			Observer(const BasicFlatTree* inTree, Index inParent, Index inNode)
+				: tree(inTree), parentIndex(inParent), nodeIndex(inNode) {}
+
+			const Node& node() const
+			{
+				return tree->nodes[nodeIndex];
+			}
+
+			const Node& parentNode() const
+			{
+				return tree->nodes[parentIndex];
+			}
+
+			friend class BasicFlatTree<ValueType>;
+
+		public:
+
+			Observer() {}
+			Observer(const Observer& src) = default;
+
+			Observer& operator=(const Observer& src) = default;
+
+			bool operator==(const Observer& other) const
+			{
+				return tree == other.tree && parentIndex == other.parentIndex && nodeIndex == other.nodeIndex;
+			}
+			bool operator!=(const Observer& other) const
+			{
+				return !(*this == other);
+			}
+
+			Observer& operator++()
+			{
+				nodeIndex = node().nextSibling;
+				return *this;
+			}
+			Observer& operator--()
+			{
+				nodeIndex = nodeIndex == npos ? parentNode().lastChild : node().prevSibling;
+				return *this;
+			}
+
+			bool childrenEmpty() const
+			{
+				return node().firstChild == npos;
+			}
+
+			Size thisSize() const
+			{
+				return parent().childrenSize();
+			}
+			Size childrenSize() const
+			{
+				Size size = 0;
+				for (auto i = node().firstChild; i != npos; i = tree->nodes[i].nextSibling) ++size;
+				return size;
+			}
+
+			Observer parent() const
+			{
+				return { tree, parentNode().parent, parentIndex };
+			}
+
+			Observer thisBegin() const
+			{
+				return parent().childrenBegin();
+			}
+			Observer thisEnd() const
+			{
+				return parent().childrenEnd();
+			}
+			Observer thisNext() const
+			{
+				auto temp = *this;
+				return ++temp;
+			}
+			Observer thisPrev() const
+			{
+				auto temp = *this;
+				return --temp;
+			}
+
+			Observer childrenBegin() const
+			{
+				return { tree, nodeIndex, node().firstChild };
+			}
+			Observer childrenEnd() const
+			{
+				return { tree, nodeIndex, npos };
+			}
+
+			const ValueType& value() const
+			{
+				return node().value;
+			}
+
+			const ValueType& childrenFrontValue() const
+			{
+				return tree->nodes[node().firstChild].value;
+			}
+
+			const ValueType& childrenBackValue() const
+			{
+				return tree->nodes[node().lastChild].value;
+			}
+
+			~Observer() = default;
+		};
+
+		template <typename SourceTree, typename = decltype(std::declval<const SourceTree&>().observer())>
+		explicit BasicFlatTree(const SourceTree& src)
+		{
+			nodes.emplace_back(UnusedConstruct(std::in_place_type<ValueType>), npos);
+			build(src.observer());
+		}
+
+		BasicFlatTree(const BasicFlatTree&) = default;
+		BasicFlatTree(BasicFlatTree&&) noexcept = default;
+
+		BasicFlatTree& operator=(const BasicFlatTree&) = default;
+		BasicFlatTree& operator=(BasicFlatTree&&) noexcept = default;
+
+		Observer observer() const
+		{
+			return { this, 0, nodes[0].firstChild };
+		}
+
+		// number of nodes, the hidden node excluded
+		Size size() const
+		{
+			return nodes.size() - 1;
+		}
+
+		// bytes occupied by the node storage
+		Size capacityBytes() const
+		{
+			return nodes.capacity() * sizeof(Node);
+		}
+
+		bool operator==(const BasicFlatTree& other) const
+		{
+			if (nodes.size() != other.nodes.size()) return false;
+
+			for (Size i = 0; i < nodes.size(); ++i)
+			{
+				const auto& lhs = nodes[i];
+				const auto& rhs = other.nodes[i];
+
+				if (!(lhs.value == rhs.value) || lhs.parent != rhs.parent || lhs.nextSibling != rhs.nextSibling) return false;
+			}
+
+			return true;
+		}
+		bool operator!=(const BasicFlatTree& other) const
+		{
+			return !(*this == other);
+		}
+
+		~BasicFlatTree() = default;
+	};
+
+	template <typename StringView>
+	class BasicFlatParseTree : public BasicFlatTree<BasicParseUnit<StringView>>
+	{
+	public:
+
+		using Unit = BasicParseUnit<StringView>;
+
+	private:
+
+		using Super = BasicFlatTree<Unit>;
+
+	public:
+
+		using typename Super::Observer;
+
+		using UnitName = typename Unit::Name;
+		using UnitValue = typename Unit::StringView;
+		using UnitType = typename Unit::Type;
+
+		template <typename Allocator>
+		explicit BasicFlatParseTree(const BasicParseTree<StringView, Allocator>& src)
+			: Super(src) {}
+	};
+
+	using FlatParseTree = BasicFlatParseTree<std::string_view>;
+}
@@ -0,0 +1,170 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#include "irgenerator.hpp"
+#include "parser.hpp"
+
+namespace Chtholly
+{
+	// An event sink of the parser generating the IR while parsing, the result is the same as BasicIRGenerator::Generate.
+	// The expressions of the top-level Expression are generated as soon as the next one begins,
+	// so only the expression being parsed is kept as a tree.
+	template <typename StringView>
+	class BasicFusedIRGenerator
+	{
+	public:
+
+		using Generator = BasicIRGenerator<StringView>;
+
+		using Tree = typename Generator::Tree;
+		using Sequence = typename Generator::Sequence;
+
+		using UnitName = typename Tree::UnitName;
+		using Size = std::size_t;
+
+	private:
+
+		using PackageState = typename Generator::PackageState;
+		using PackageContext = typename Generator::PackageContext;
+
+		inline static constexpr auto expressionName = ParseUnitName::Predefined("Expression");
+
+		inline static const typename Generator::GenerateFunc walk = Generator::Walk;
+
+		// where the first child of the root, the one which is generated, stands
+		enum class Stage { before, package, after, done };
+
+		Tree buffer;
+		BasicTreeSink<Tree> builder;
+
+		Sequence seq;
+		typename Generator::State state;
+
+		Size depth = 0;
+		Stage stage = Stage::before;
+
+		PackageState packageState = PackageState::value;
+		bool lastIsSeparator = false;
+
+		typename Tree::Modifier package()
+		{
+			return buffer.modifier().childrenBegin();
+		}
+
+		// generate the first child of the top-level Expression, then drop it
+		void generateFront()
+		{
+			auto child = package().childrenBegin();
+			lastIsSeparator = child.value().name == Generator::separatorName;
+
+			PackageContext context{ walk, seq, state };
+			packageState = Generator::packageAutomaton.step(context, packageState, child);
+
+			child.thisErase(child);
+		}
+
+		// a new child of the top-level Expression begins, so the previous one can't be discarded anymore
+		void beginChild()
+		{
+			if (depth == 0 && stage == Stage::before) stage = Stage::after;
+			if (depth == 1 && stage == Stage::package && !package().childrenEmpty()) generateFront();
+		}
+
+	public:
+
+		BasicFusedIRGenerator() : builder(buffer.modifier()) {}
+
+		BasicFusedIRGenerator(const BasicFusedIRGenerator&) = delete;
+
+		BasicFusedIRGenerator& operator=(const BasicFusedIRGenerator&) = delete;
+
+		void enterTerm(const UnitName& name)
+		{
+			beginChild();
+			if (depth == 0 && stage == Stage::after && buffer.observer().childrenEmpty() && name == expressionName) stage = Stage::package;
+
+			builder.enterTerm(name);
+			++depth;
+		}
+
+		void token(const UnitName& name, const StringView& value)
+		{
+			beginChild();
+			builder.token(name, value);
+		}
+
+		void exitTerm(bool collapsed)
+		{
+			--depth;
+
+			if (depth == 0 && stage == Stage::package)
+			{
+				if (collapsed)
+				{
+					// the single expression takes the place of the Expression, it is generated as it is
+					stage = Stage::after;
+				}
+				else
+				{
+					if (!package().childrenEmpty()) generateFront();
+					if (!lastIsSeparator) Generator::Emit(seq, state, Instruction::Block::End());
+					stage = Stage::done;
+				}
+			}
+
+			builder.exitTerm(collapsed);
+		}
+
+		void discard()
+		{
+			if (depth == 1 && stage == Stage::package && package().childrenEmpty())
+				throw std::logic_error("FusedIRGenerator: an expression already generated is discarded");
+
+			builder.discard();
+		}
+
+		// The IR, once every event is reported
+		Sequence finish()
+		{
+			if (stage == Stage::after) Generator::Walk(buffer.observer().childrenBegin(), seq, state);
+
+			stage = Stage::done;
+			return std::move(seq);
+		}
+
+		// Parse source and generate its IR without building its tree
+		static Sequence Generate(const StringView& source)
+		{
+			using EventParser = BasicParser<StringView, BasicEventBuilder<StringView, BasicFusedIRGenerator>>;
+
+			BasicFusedIRGenerator generator;
+
+			typename EventParser::Builder::Context context(generator);
+			EventParser::Expression(EventParser::MakeInfo(source, context.cursor()));
+			context.finish();
+
+			return generator.finish();
+		}
+	};
+
+	using FusedIRGenerator = BasicFusedIRGenerator<std::string_view>;
+}
@@ -0,0 +1,235 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "parsetree.hpp"
+
+namespace Chtholly
+{
+	// Merkle-style hash of the subtree under root: a node hashes its value together with the hashes of its children.
+	// Works on any observer (BasicTree, BasicFlatTree, ...), without recursion.
+	template <typename Observer>
+	std::size_t StructuralHash(const Observer& root)
+	{
+		using ValueType = std::decay_t<decltype(root.value())>;
+
+		struct Frame
+		{
+			Observer node;
+			Observer child;
+			std::size_t hash;
+			std::size_t size;
+		};
+
+		std::vector<Frame> pending{ { root, root.childrenBegin(), std::hash<ValueType>{}(root.value()), 0 } };
+
+		while (true)
+		{
+			auto& top = pending.back();
+
+			if (top.child != top.node.childrenEnd())
+			{
+				auto child = top.child;
+				++top.child;
+				++top.size;
+
+				pending.push_back({ child, child.childrenBegin(), std::hash<ValueType>{}(child.value()), 0 });
+				continue;
+			}
+
+			const auto hash = HashCombine(top.hash, top.size);
+			pending.pop_back();
+
+			if (pending.empty()) return hash;
+			pending.back().hash = HashCombine(pending.back().hash, hash);
+		}
+	}
+
+	// What a pool keeps of a value: by default the value itself
+	template <typename ValueType>
+	struct PoolValue
+	{
+		struct Storage {};
+
+		static ValueType Own(const ValueType& value, Storage&)
+		{
+			return value;
+		}
+	};
+
+	// the spelling of a parse unit is copied into the pool, so interned trees outlive the source they were parsed from
+	template <typename StringView>
+	struct PoolValue<BasicParseUnit<StringView>>
+	{
+		// a node-based set, whose strings never move
+		using Storage = std::unordered_set<std::basic_string<typename StringView::value_type, typename StringView::traits_type>>;
+
+		static BasicParseUnit<StringView> Own(const BasicParseUnit<StringView>& unit, Storage& storage)
+		{
+			const auto& spelling = *storage.emplace(unit.value).first;
+			return { unit.type, unit.name, StringView(spelling) };
+		}
+	};
+
+	// A pool of immutable, maximally shared subtrees.
+	// Every distinct subtree is stored once, so two interned subtrees are equal iff they are the same node.
+	template <typename inValueType>
+	class BasicHashConsPool
+	{
+	public:
+
+		using ValueType = inValueType;
+		using Size = std::size_t;
+
+		class Node;
+
+		using Ref = const Node*;
+
+		class Node
+		{
+			ValueType _value;
+			std::vector<Ref> _children;
+			std::size_t _hash;
+
+			friend class BasicHashConsPool<ValueType>;
+
+		public:
+
+			Node(const ValueType& inValue, std::vector<Ref> inChildren)
+				: _value(inValue), _children(std::move(inChildren)), _hash(std::hash<ValueType>{}(_value))
+			{
+				for (auto child : _children) _hash = HashCombine(_hash, child->_hash);
+				_hash = HashCombine(_hash, _children.size());
+			}
+
+			const ValueType& value() const
+			{
+				return _value;
+			}
+
+			const std::vector<Ref>& children() const
+			{
+				return _children;
+			}
+
+			// cached structural hash, equal to StructuralHash of the subtree it was interned from
+			std::size_t hash() const
+			{
+				return _hash;
+			}
+		};
+
+	private:
+
+		struct NodeHash
+		{
+			std::size_t operator()(Ref node) const
+			{
+				return node->hash();
+			}
+		};
+
+		// children are already interned, so comparing them is comparing pointers
+		struct NodeEqual
+		{
+			bool operator()(Ref lhs, Ref rhs) const
+			{
+				return lhs->hash() == rhs->hash() && lhs->value() == rhs->value() && lhs->children() == rhs->children();
+			}
+		};
+
+		std::deque<Node> nodes;
+		std::unordered_set<Ref, NodeHash, NodeEqual> index;
+		typename PoolValue<ValueType>::Storage storage;
+
+	public:
+
+		BasicHashConsPool() = default;
+
+		// nodes are referenced by address, so the pool is neither copyable nor movable
+		BasicHashConsPool(const BasicHashConsPool&) = delete;
+
+		BasicHashConsPool& operator=(const BasicHashConsPool&) = delete;
+
+		Ref intern(const ValueType& value, std::vector<Ref> children = {})
+		{
+			Node candidate(value, std::move(children));
+
+			if (auto found = index.find(&candidate); found != index.end()) return *found;
+
+			candidate._value = PoolValue<ValueType>::Own(candidate._value, storage);
+			auto& node = nodes.emplace_back(std::move(candidate));
+			index.insert(&node);
+			return &node;
+		}
+
+		// Intern the subtree under root, without recursion
+		template <typename Observer, typename = decltype(std::declval<const Observer&>().childrenBegin())>
+		Ref intern(const Observer& root)
+		{
+			struct Frame
+			{
+				Observer node;
+				Observer child;
+				std::vector<Ref> children;
+			};
+
+			std::vector<Frame> pending{ { root, root.childrenBegin(), {} } };
+
+			while (true)
+			{
+				auto& top = pending.back();
+
+				if (top.child != top.node.childrenEnd())
+				{
+					auto child = top.child;
+					++top.child;
+
+					pending.push_back({ child, child.childrenBegin(), {} });
+					continue;
+				}
+
+				auto interned = intern(top.node.value(), std::move(top.children));
+				pending.pop_back();
+
+				if (pending.empty()) return interned;
+				pending.back().children.push_back(interned);
+			}
+		}
+
+		// number of distinct subtrees in the pool
+		Size size() const
+		{
+			return nodes.size();
+		}
+
+		~BasicHashConsPool() = default;
+	};
+
+	template <typename StringView>
+	using BasicParseHashConsPool = BasicHashConsPool<BasicParseUnit<StringView>>;
+
+	using ParseHashConsPool = BasicParseHashConsPool<std::string_view>;
+}
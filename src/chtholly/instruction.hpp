@@ -16,20 +16,18 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <iterator>
 
 namespace Chtholly
 {
-	template <auto V>
-	struct LiteralValueIdentity
-	{
-		constexpr static auto value = V;
-	};
-
 	template <typename T>
 	struct AlwaysEq
 	{
@@ -72,14 +70,106 @@ namespace Chtholly
 
 	using IRValue = BasicIRValue<>;
 
+	// every instruction generator, in opcode order, with the kinds of its operands:
+	// s a string, i an integer, f a float, b a bool, and * for any operands;
+	// append new entries at the end so that persisted opcodes stay valid
+#define CHTHOLLY_OPCODES(X) \
+	X(None, None, "*") \
+	X(BlockBegin, Block::Begin, "") X(BlockNamedBegin, Block::NamedBegin, "s") \
+	X(BlockDrop, Block::Drop, "") X(BlockEnd, Block::End, "") \
+	X(FunctionBegin, Function::Begin, "") X(FunctionEnd, Function::End, "") X(FunctionCall, Function::Call, "") \
+	X(ListPush, List::Push, "") X(ListPop, List::Pop, "") \
+	X(ControlJump, Control::Jump, "s") X(ControlJumpIf, Control::JumpIf, "s") \
+	X(ControlJumpIfElse, Control::JumpIfElse, "ss") X(ControlMark, Control::Mark, "s") \
+	X(ObjectBegin, Object::Begin, "") X(ObjectEnd, Object::End, "") \
+	X(ObjectEndWithInit, Object::EndWithInit, "") X(ObjectAttachTo, Object::AttachTo, "s") \
+	X(ObjectVar, Object::Var, "s") X(ObjectVarWithConstraint, Object::VarWithConstraint, "s") \
+	X(ObjectVarPack, Object::VarPack, "s") X(ObjectVarPackWithConstraint, Object::VarPackWithConstraint, "s") \
+	X(ObjectConst, Object::Const, "s") X(ObjectConstWithConstraint, Object::ConstWithConstraint, "s") \
+	X(ObjectConstPack, Object::ConstPack, "s") X(ObjectConstPackWithConstraint, Object::ConstPackWithConstraint, "s") \
+	X(ObjectUse, Object::Use, "s") \
+	X(LiteralInt, Literal::Int, "i") X(LiteralFloat, Literal::Float, "f") \
+	X(LiteralString, Literal::String, "s") X(LiteralBool, Literal::Bool, "b") \
+	X(LiteralNull, Literal::Null, "") X(LiteralUndef, Literal::Undef, "") \
+	X(ControlJumpTo, Control::JumpTo, "i") X(ControlJumpIfTo, Control::JumpIfTo, "i") \
+	X(ControlJumpIfElseTo, Control::JumpIfElseTo, "ii") \
+	X(LiteralConstant, Literal::Constant, "i")
+
+	enum class OpcodeId : std::uint8_t
+	{
+#define CHTHOLLY_OPCODE_ENUM(id, func, signature) id,
+		CHTHOLLY_OPCODES(CHTHOLLY_OPCODE_ENUM)
+#undef CHTHOLLY_OPCODE_ENUM
+	};
+
+	inline constexpr std::string_view opcodeNames[] =
+	{
+#define CHTHOLLY_OPCODE_NAME(id, func, signature) #func,
+		CHTHOLLY_OPCODES(CHTHOLLY_OPCODE_NAME)
+#undef CHTHOLLY_OPCODE_NAME
+	};
+
+	inline constexpr std::size_t opcodeCount = std::size(opcodeNames);
+
+	inline constexpr std::string_view opcodeSignatures[] =
+	{
+#define CHTHOLLY_OPCODE_SIGNATURE(id, func, signature) signature,
+		CHTHOLLY_OPCODES(CHTHOLLY_OPCODE_SIGNATURE)
+#undef CHTHOLLY_OPCODE_SIGNATURE
+	};
+
+	// kinds of the operands of an opcode, one letter each as in CHTHOLLY_OPCODES, or an empty view if out of range
+	constexpr std::string_view OpcodeSignature(OpcodeId code)
+	{
+		return std::size_t(code) < opcodeCount ? opcodeSignatures[std::size_t(code)] : std::string_view{};
+	}
+
+	// name of the generator of an opcode, e.g. "Block::Begin", or an empty view if out of range
+	constexpr std::string_view OpcodeName(OpcodeId code)
+	{
+		return std::size_t(code) < opcodeCount ? opcodeNames[std::size_t(code)] : std::string_view{};
+	}
+
+	// whether every operand of an opcode names something (a variable, block or jump tag)
+	// rather than holding a literal value
+	constexpr bool HasSymbolOprands(OpcodeId code)
+	{
+		switch (code)
+		{
+		case OpcodeId::BlockNamedBegin:
+		case OpcodeId::ControlJump: case OpcodeId::ControlJumpIf:
+		case OpcodeId::ControlJumpIfElse: case OpcodeId::ControlMark:
+		case OpcodeId::ObjectAttachTo:
+		case OpcodeId::ObjectVar: case OpcodeId::ObjectVarWithConstraint:
+		case OpcodeId::ObjectVarPack: case OpcodeId::ObjectVarPackWithConstraint:
+		case OpcodeId::ObjectConst: case OpcodeId::ObjectConstWithConstraint:
+		case OpcodeId::ObjectConstPack: case OpcodeId::ObjectConstPackWithConstraint:
+		case OpcodeId::ObjectUse:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	template <typename Function>
+	struct GeneratorResult;
+
+	template <typename R, typename... Args>
+	struct GeneratorResult<R(*)(Args...)>
+	{
+		using Type = R;
+	};
+
+	// maps an instruction generator (e.g. &Instruction::Block::Begin) to its opcode at compile time
 	template <auto Generator
 		, std::enable_if_t<
 		std::is_function_v<std::remove_pointer_t<decltype(Generator)>>
 		, int> = 0
 	>
-		static constexpr std::size_t Opcode()
+		static constexpr OpcodeId Opcode()
 	{
-		return typeid(LiteralValueIdentity<Generator>).hash_code();
+		constexpr auto code = GeneratorResult<decltype(Generator)>::Type::template OpcodeOf<Generator>();
+		return code;
 	}
 
 	template<typename V>
@@ -90,15 +180,15 @@ namespace Chtholly
 
 	private:
 
-		std::size_t _opcode;
+		OpcodeId _opcode;
 		std::vector<Value> _oprands;
 
-		BasicInstruction(std::size_t hash)
-			: _opcode(hash)
+		BasicInstruction(OpcodeId code)
+			: _opcode(code)
 		{}
 
-		BasicInstruction(std::size_t hash, std::vector<Value> value)
-			: _opcode(hash), _oprands(std::move(value))
+		BasicInstruction(OpcodeId code, std::vector<Value> value)
+			: _opcode(code), _oprands(std::move(value))
 		{}
 
 	public:
@@ -116,16 +206,33 @@ namespace Chtholly
 			return _opcode == other._opcode && _oprands == other._oprands;
 		}
 
-		std::size_t opcode() const
+		OpcodeId opcode() const
 		{
 			return _opcode;
 		}
 
-		const std::vector<IRValue>& oprands() const
+		// the opcode of a generator, by a specialization for each of them at the end of the class
+		template <auto Generator, typename = void>
+		struct GeneratorOpcode;
+
+		// the opcode of one of the generators below; ill-formed for other functions
+		template <auto Generator>
+		static constexpr OpcodeId OpcodeOf()
+		{
+			return GeneratorOpcode<Generator>::value;
+		}
+
+		const std::vector<Value>& oprands() const
 		{
 			return _oprands;
 		}
 
+		// rebuild an instruction from its parts, e.g. when decoding a stored form
+		static BasicInstruction Make(OpcodeId code, std::vector<Value> oprands = {})
+		{
+			return { code, std::move(oprands) };
+		}
+
 		static BasicInstruction None() { return { Opcode<None>() }; }
 
 		struct Block
@@ -172,6 +279,20 @@ namespace Chtholly
 			{
 				return { Opcode<Mark>(), { tag } };
 			}
+
+			// jumps to instruction indices, produced by linking the tagged jumps above
+			static BasicInstruction JumpTo(typename Value::Int target)
+			{
+				return { Opcode<JumpTo>(), { target } };
+			}
+			static BasicInstruction JumpIfTo(typename Value::Int target)
+			{
+				return { Opcode<JumpIfTo>(), { target } };
+			}
+			static BasicInstruction JumpIfElseTo(typename Value::Int targetIf, typename Value::Int targetElse)
+			{
+				return { Opcode<JumpIfElseTo>(), { targetIf, targetElse } };
+			}
 		};
 
 		struct Object
@@ -242,9 +363,27 @@ namespace Chtholly
 			static BasicInstruction Null() { return { Opcode<Null>() }; }
 			static BasicInstruction Undef() { return { Opcode<Undef>() }; }
 
+			// a fresh copy of a value folded into the constants of the module
+			static BasicInstruction Constant(typename Value::Int index)
+			{
+				return { Opcode<Constant>(), { index } };
+			}
+
 		};
+
+		// matched by the identity of the generator, so that no address comparison is ever evaluated
+#define CHTHOLLY_OPCODE_OF(id, func, signature) \
+		template <typename Unused> \
+		struct GeneratorOpcode<&func, Unused> \
+		{ \
+			inline static constexpr OpcodeId value = OpcodeId::id; \
+		};
+		CHTHOLLY_OPCODES(CHTHOLLY_OPCODE_OF)
+#undef CHTHOLLY_OPCODE_OF
 	};
 
+#undef CHTHOLLY_OPCODES
+
 	using Instruction = BasicInstruction<IRValue>;
 
 }
@@ -17,17 +17,20 @@
 #pragma once
 
 #include <map>
+#include <array>
 #include <functional>
+#include <stdexcept>
 
 #include "parsetree.hpp"
 #include "instruction.hpp"
+#include "blockindex.hpp"
 #include "stringconv.hpp"
 #include "automata.hpp"
 #include "functional.hpp"
 
 namespace Chtholly
 {
-	template <typename StringView>
+	template <typename StringView, typename inTree = BasicParseTree<StringView>>
 	struct BasicIRGenerator
 	{
 		struct State
@@ -59,6 +62,9 @@ namespace Chtholly
 			}
 
 			ObjectProp objectProp = ObjectProp::Invalid;
+
+			// the bracket index filled while emitting, if any
+			BlockIndex* index = nullptr;
 		};
 
 		using StateRef = State&;
@@ -67,9 +73,9 @@ namespace Chtholly
 
 		using SequenceRef = Sequence&;
 
-		using Tree = BasicParseTree<StringView>;
+		using Tree = inTree;
 
-		using UnitName = typename Tree::Unit::String;
+		using UnitName = typename Tree::Unit::Name;
 
 		using Iter = typename Tree::Observer;
 		
@@ -77,38 +83,86 @@ namespace Chtholly
 
 		using Map = std::map<UnitName, GenerateFunc>;
 
+		// Generation functions indexed by the id of the unit name, empty for the names without generation
+		using Table = std::array<GenerateFunc, ParseUnitName::predefinedSize>;
+
+		// Only the names of the grammar can be generated, which is checked when the table is built
+		static Table MakeTable(const Map& map)
+		{
+			Table table;
+			for (auto&& [name, func] : map)
+			{
+				if (name.id() >= table.size()) throw std::invalid_argument("IRGenerator: " + name.str() + " is not a name of the grammar");
+				if (!func) throw std::invalid_argument("IRGenerator: empty generation for " + name.str());
+				table[name.id()] = func;
+			}
+
+			return table;
+		}
+
+		static bool Supports(const UnitName& name)
+		{
+			return name.id() < table.size() && table[name.id()];
+		}
+
+		// Reject a tree with a kind the table cannot generate before anything is generated.
+		// Separators are read by the unit holding them, every other unit is walked
+		static void Check(Iter root)
+		{
+			for (std::vector<Iter> pending{ root }; !pending.empty();)
+			{
+				const auto current = pending.back();
+				pending.pop_back();
+
+				const auto name = current.value().name;
+				if (name != separatorName && !Supports(name)) throw std::invalid_argument("IRGenerator: no generation for " + name.str());
+
+				for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child) pending.push_back(child);
+			}
+		}
+
 		static void Walk(Iter iter, SequenceRef seq, StateRef state)
 		{
-			return map.at(iter.value().name)(iter, seq, state);
+			const auto name = iter.value().name;
+			if (!Supports(name)) throw std::invalid_argument("IRGenerator: no generation for " + name.str());
+
+			return table[name.id()](iter, seq, state);
+		}
+
+		// append an instruction to the sequence and to the bracket index of the state
+		static void Emit(SequenceRef seq, StateRef state, const Instruction& instruction)
+		{
+			seq.push_back(instruction);
+			if (state.index) state.index->append(instruction.opcode());
 		}
 
 		static auto PushInstruction(const std::function<Instruction(StringView)>& toInstruction) 
 		{
-			return [=](Iter iter, SequenceRef seq, StateRef) {
-				seq.push_back(toInstruction(iter.value().value));
+			return [=](Iter iter, SequenceRef seq, StateRef state) {
+				Emit(seq, state, toInstruction(iter.value().value));
 			};
 		}
 		
 		static auto PushInstructionIf(const std::function<Instruction(StringView)>& toInstruction, const std::function<bool(Iter)>& predicate)
 		{
-			return [=](Iter iter, SequenceRef seq, StateRef) {
+			return [=](Iter iter, SequenceRef seq, StateRef state) {
 				if (predicate(iter))
 				{
-					seq.push_back(toInstruction(iter.value().value));
+					Emit(seq, state, toInstruction(iter.value().value));
 				}
 			};
 		}
 
 		static auto PushInstructionIfElse(const std::function<Instruction(StringView)>& toInstructionT, const std::function<Instruction(StringView)>& toInstructionF, const std::function<bool(Iter)>& predicate)
 		{
-			return [=](Iter iter, SequenceRef seq, StateRef) {
+			return [=](Iter iter, SequenceRef seq, StateRef state) {
 				if (predicate(iter))
 				{
-					seq.push_back(toInstructionT(iter.value().value));
+					Emit(seq, state, toInstructionT(iter.value().value));
 				}
 				else
 				{
-					seq.push_back(toInstructionF(iter.value().value));
+					Emit(seq, state, toInstructionF(iter.value().value));
 				}
 			};
 		}
@@ -130,12 +184,13 @@ namespace Chtholly
 			});
 		}
 
-		template <typename F>
-		static auto IterateChildrenInAutomaton(F&& iterateFunc, 
-			std::enable_if_t<is_instance_of_v<std::invoke_result_t<decltype(iterateFunc), SequenceRef, StateRef>, FiniteAutomaton>, int> = 0)
+		// Run automaton over the children, with a context made from the sequence and the state
+		template <typename Automaton, typename MakeContext>
+		static auto IterateChildrenInAutomaton(const Automaton& automaton, MakeContext&& makeContext)
 		{
-			return IterateChildren([=](Iter begin, Iter end, SequenceRef seq, StateRef state) {
-				iterateFunc(seq, state)(begin, end);
+			return IterateChildren([&automaton, makeContext](Iter begin, Iter end, SequenceRef seq, StateRef state) {
+				auto context = makeContext(seq, state);
+				automaton(context, begin, end);
 			});
 		}
 
@@ -161,41 +216,58 @@ namespace Chtholly
 			});
 		}
 
+		inline static constexpr auto separatorName = ParseUnitName::Predefined("Separator");
+
+		enum class PackageState { value, sep, error };
+
+		struct PackageContext
+		{
+			const GenerateFunc& iterateFunc;
+			SequenceRef seq;
+			StateRef state;
+		};
+
+		// values separated by ';' or ',', every value in a block
+		inline static constexpr TableAutomaton<PackageState, 3, PackageContext, Iter> packageAutomaton{ PackageState::value, PackageState::error, {
+			[](PackageContext& context, Iter it) {
+				Emit(context.seq, context.state, Instruction::Block::Begin());
+				context.iterateFunc(it, context.seq, context.state);
+				return PackageState::sep;
+			},
+			[](PackageContext& context, Iter it) {
+				if (it.value().name == separatorName)
+				{
+					if (it.value().value == ";")
+					{
+						Emit(context.seq, context.state, Instruction::Block::End());
+					}
+					else if (it.value().value == ",")
+					{
+						Emit(context.seq, context.state, Instruction::Block::Drop());
+					}
+
+					return PackageState::value;
+				}
+				return PackageState::error;
+			},
+			[](PackageContext&, Iter) {
+				return PackageState::error;
+			}
+		} };
+
 		static auto MultiExpressionPackage(const GenerateFunc& iterateFunc)
 		{
-			return sequence(IterateChildrenInAutomaton([=](SequenceRef seq, StateRef state) {
-				return FiniteAutomaton<std::string, Iter> {"value", "error", {
-					{"value", [&](Iter it) {
-						seq.push_back(Instruction::Block::Begin());
-						iterateFunc(it, seq, state);
-						return "sep";
-					}},
-					{"sep", [&](Iter it) {
-						if (it.value().name == "Separator")
-						{
-							if (it.value().value == ";")
-							{
-								seq.push_back(Instruction::Block::End());
-							}
-							else if (it.value().value == ",")
-							{
-								seq.push_back(Instruction::Block::Drop());
-							}
-
-							return "value";
-						}
-						return "error";
-					}}
-				}};
+			return sequence(IterateChildrenInAutomaton(packageAutomaton, [=](SequenceRef seq, StateRef state) {
+				return PackageContext{ iterateFunc, seq, state };
 			}), PushInstructionIf(
 				constant(Instruction::Block::End()),
 				[](Iter iter) {
-					return (--iter.childrenEnd()).value().name != "Separator";
+					return (--iter.childrenEnd()).value().name != separatorName;
 				}
 			));
 		}
 		
-		inline static const Map map = {
+		inline static const Table table = MakeTable({
 			{"IntLiteral", PushInstruction(compose(
 				Instruction::Literal::Int, Conv<StringView>::template To<Instruction::Value::Int>
 			))},
@@ -271,7 +343,7 @@ namespace Chtholly
 				{
 					Walk(constraint, seq, state);
 				}
-				seq.push_back(
+				Emit(seq, state,
 					State::ObjectPropMap(state.objectProp, hasConstraint)(Instruction::Value::String{ identifier.value().value })
 				);
 			}},
@@ -280,7 +352,7 @@ namespace Chtholly
 				auto constraint = identifier.thisNext();
 				auto separator = iter.childrenEnd();
 
-				if(constraint != iter.childrenEnd() && constraint.value().name == "Separator")
+				if(constraint != iter.childrenEnd() && constraint.value().name == separatorName)
 				{
 					separator = constraint;
 					constraint = separator.thisNext();
@@ -293,7 +365,7 @@ namespace Chtholly
 				{
 					Walk(constraint, seq, state);
 				}
-				seq.push_back(
+				Emit(seq, state,
 					State::ObjectPropMap(state.objectProp, hasConstraint, hasSeparator)(Instruction::Value::String{ identifier.value().value })
 				);
 			}},
@@ -304,13 +376,30 @@ namespace Chtholly
 				SetStateProp(&State::objectProp, State::ObjectProp::Invalid),
 				PushInstruction(constant(Instruction::Function::End()))
 			)}
-		};
+		});
 		
 		static Sequence Generate(const Tree& tree)
 		{
+			Check(tree.observer().childrenBegin());
+
+			Sequence seq;
+			State state;
+			Walk(tree.observer().childrenBegin(), seq, state);
+			return seq;
+		}
+
+		// generate and index the brackets of the sequence while emitting it
+		static Sequence Generate(const Tree& tree, BlockIndex& index)
+		{
+			Check(tree.observer().childrenBegin());
+
+			index = BlockIndex();
+
 			Sequence seq;
 			State state;
+			state.index = &index;
 			Walk(tree.observer().childrenBegin(), seq, state);
+			index.finish();
 			return seq;
 		}
 	};
@@ -0,0 +1,299 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "instruction.hpp"
+#include "stringconv.hpp"
+
+namespace Chtholly
+{
+	// Text form of an instruction sequence, one instruction per line:
+	//   Object::Var "a"
+	//   Literal::Float 2.5
+	//   Control::JumpIfElseTo 3 7
+	// operands are undef, null, true, false, integers, floats (always with a '.', an exponent, inf or nan)
+	// and quoted strings with the escapes of the language; '#' starts a comment which runs to the end of the line.
+	// The operands must match the signature of the opcode in CHTHOLLY_OPCODES, e.g. a single string for Object::Use.
+	// Floats are written with the fewest digits that read back exactly, so assembling a disassembled sequence gives it back.
+	// Floats go through printf and strtod, since the floating-point charconv is missing in libstdc++ 8 and MSVC 2017;
+	// the text always has a '.' for the decimal point, whatever the decimal point of the current C locale.
+	template <typename V>
+	class BasicIRText
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+		using Sequence = std::vector<Instruction>;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+		using Float = typename Value::Float;
+
+		using Size = std::size_t;
+
+	private:
+
+		// the decimal point printf writes and strtod reads
+		static std::string_view LocalePoint()
+		{
+			return std::localeconv()->decimal_point;
+		}
+
+		static void AppendOprand(std::string& out, const Value& value)
+		{
+			char buffer[32];
+
+			if (std::get_if<typename Value::Undef>(&value)) out += "undef";
+			else if (std::get_if<typename Value::Null>(&value)) out += "null";
+			else if (auto v = std::get_if<typename Value::Bool>(&value)) out += *v ? "true" : "false";
+			else if (auto v = std::get_if<Int>(&value))
+			{
+				out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *v).ptr);
+			}
+			else if (auto v = std::get_if<Float>(&value))
+			{
+				// 17 significant digits always read back exactly, fewer are enough for most values
+				int size = 0;
+				for (int precision = 15; precision <= 17; ++precision)
+				{
+					size = std::snprintf(buffer, sizeof(buffer), "%.*g", precision, double(*v));
+					if (std::isnan(*v) || std::strtod(buffer, nullptr) == double(*v)) break;
+				}
+				std::string text(buffer, size);
+				if (const auto point = LocalePoint(); point != ".")
+				{
+					if (const auto at = text.find(point); at != std::string::npos) text.replace(at, point.size(), ".");
+				}
+
+				// keep integral floats apart from integers
+				if (text.find_first_of(".eEn") == std::string::npos) text += ".0";
+				out += text;
+			}
+			else out += Conv<Unquoted<String>>::template To<String>(std::get<String>(value));
+		}
+
+		[[noreturn]] static void Fail(Size line, const std::string& reason)
+		{
+			throw std::invalid_argument("IRText: line " + std::to_string(line) + ": " + reason);
+		}
+
+		static OpcodeId ParseOpcode(std::string_view name, Size line)
+		{
+			static const auto codes = [] {
+				std::unordered_map<std::string_view, OpcodeId> codes;
+				for (Size i = 0; i < opcodeCount; ++i) codes.emplace(opcodeNames[i], OpcodeId(i));
+				return codes;
+			}();
+
+			auto found = codes.find(name);
+			if (found == codes.end()) Fail(line, "unknown opcode '" + std::string(name) + "'");
+
+			return found->second;
+		}
+
+		// parse the operand at the front of text and drop it from text
+		static Value ParseOprand(std::string_view& text, Size line)
+		{
+			if (text.front() == '"')
+			{
+				Size end = 1;
+				while (end < text.size() && text[end] != '"') end += text[end] == '\\' ? 2 : 1;
+				if (end >= text.size()) Fail(line, "unterminated string");
+
+				const auto quoted = text.substr(0, end + 1);
+				text.remove_prefix(end + 1);
+
+				return Conv<Quoted<std::string_view>>::template To<String>(quoted);
+			}
+
+			const auto token = text.substr(0, std::min(text.find_first_of(" \t#"), text.size()));
+			text.remove_prefix(token.size());
+
+			if (token == "undef") return typename Value::Undef{};
+			if (token == "null") return typename Value::Null{};
+			if (token == "true") return typename Value::Bool(true);
+			if (token == "false") return typename Value::Bool(false);
+
+			const auto first = token.data(), last = token.data() + token.size();
+
+			Int integer;
+			if (auto [end, error] = std::from_chars(first, last, integer); end == last)
+			{
+				if (error == std::errc{}) return integer;
+				if (error == std::errc::result_out_of_range) Fail(line, "bad operand '" + std::string(token) + "': integer out of range");
+			}
+
+			// strtod needs a terminated string, and skips leading spaces which a token never has
+			std::string terminated(token);
+			if (const auto point = LocalePoint(); point != ".")
+			{
+				if (terminated.find(point) != std::string::npos) Fail(line, "bad operand '" + std::string(token) + "'");
+				if (const auto at = terminated.find('.'); at != std::string::npos) terminated.replace(at, 1, point);
+			}
+
+			char* end = nullptr;
+			errno = 0;
+			const auto floating = std::strtod(terminated.c_str(), &end);
+			if (!terminated.empty() && end == terminated.c_str() + terminated.size() && !(errno == ERANGE && std::isinf(floating))) return Float(floating);
+
+			Fail(line, "bad operand '" + std::string(token) + "'");
+		}
+
+		// the operands must match the signature of the opcode, so that later passes can read them as they are
+		static void CheckOprands(OpcodeId code, const std::vector<Value>& oprands, Size line)
+		{
+			const auto signature = OpcodeSignature(code);
+			if (signature == "*") return;
+
+			const auto name = std::string(OpcodeName(code));
+			if (oprands.size() != signature.size()) Fail(line, "'" + name + "' takes " + std::to_string(signature.size()) + " operands, not " + std::to_string(oprands.size()));
+
+			for (Size i = 0; i < signature.size(); ++i)
+			{
+				const auto& oprand = oprands[i];
+				auto expect = [&](bool matches, const char* kind)
+				{
+					if (!matches) Fail(line, "operand " + std::to_string(i + 1) + " of '" + name + "' is not " + kind);
+				};
+
+				switch (signature[i])
+				{
+				case 's': expect(std::holds_alternative<String>(oprand), "a string"); break;
+				case 'i': expect(std::holds_alternative<Int>(oprand), "an integer"); break;
+				case 'f': expect(std::holds_alternative<Float>(oprand), "a float"); break;
+				case 'b': expect(std::holds_alternative<typename Value::Bool>(oprand), "a bool"); break;
+				}
+			}
+		}
+
+		static void SkipSpaces(std::string_view& text)
+		{
+			while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+		}
+
+	public:
+
+		// append the text of an instruction, without a line break
+		static void Disassemble(const Instruction& instruction, std::string& out)
+		{
+			out += OpcodeName(instruction.opcode());
+			for (const auto& oprand : instruction.oprands())
+			{
+				out += ' ';
+				AppendOprand(out, oprand);
+			}
+		}
+
+		static void Disassemble(const Sequence& seq, std::string& out)
+		{
+			for (const auto& instruction : seq)
+			{
+				Disassemble(instruction, out);
+				out += '\n';
+			}
+		}
+
+		static std::string Disassemble(const Sequence& seq)
+		{
+			std::string out;
+			Disassemble(seq, out);
+			return out;
+		}
+
+		// write through a buffer which is flushed every few kilobytes
+		static void Disassemble(const Sequence& seq, std::ostream& out)
+		{
+			std::string buffer;
+			buffer.reserve(8192);
+
+			for (const auto& instruction : seq)
+			{
+				Disassemble(instruction, buffer);
+				buffer += '\n';
+
+				if (buffer.size() >= 4096)
+				{
+					out.write(buffer.data(), buffer.size());
+					buffer.clear();
+				}
+			}
+
+			out.write(buffer.data(), buffer.size());
+		}
+
+		// the instruction on a single line; throws std::invalid_argument for a blank line
+		static Instruction Assemble(std::string_view text, Size line)
+		{
+			SkipSpaces(text);
+
+			const auto name = text.substr(0, std::min(text.find_first_of(" \t#"), text.size()));
+			if (name.empty()) Fail(line, "missing opcode");
+			text.remove_prefix(name.size());
+
+			const auto code = ParseOpcode(name, line);
+
+			std::vector<Value> oprands;
+			for (SkipSpaces(text); !text.empty() && text.front() != '#'; SkipSpaces(text))
+			{
+				oprands.push_back(ParseOprand(text, line));
+				if (!text.empty() && text.front() != ' ' && text.front() != '\t' && text.front() != '#') Fail(line, "missing space after operand");
+			}
+
+			CheckOprands(code, oprands, line);
+			return Instruction::Make(code, std::move(oprands));
+		}
+
+		static Sequence Assemble(std::string_view text)
+		{
+			Sequence seq;
+
+			for (Size line = 1; !text.empty(); ++line)
+			{
+				const auto lineEnd = std::min(text.find('\n'), text.size());
+				auto current = text.substr(0, lineEnd);
+				text.remove_prefix(std::min(lineEnd + 1, text.size()));
+
+				if (!current.empty() && current.back() == '\r') current.remove_suffix(1);
+
+				SkipSpaces(current);
+				if (current.empty() || current.front() == '#') continue;
+
+				seq.push_back(Assemble(current, line));
+			}
+
+			return seq;
+		}
+	};
+
+	using IRText = BasicIRText<IRValue>;
+}
@@ -0,0 +1,175 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "instruction.hpp"
+
+namespace Chtholly
+{
+	// Thrown by a link pass, holding every duplicate and missing tag of the sequence
+	template <typename inString>
+	class BasicLinkError : public std::runtime_error
+	{
+	public:
+
+		using String = inString;
+
+	private:
+
+		std::vector<String> _duplicateTags;
+		std::vector<String> _missingTags;
+
+		static std::string Describe(const std::vector<String>& duplicateTags, const std::vector<String>& missingTags)
+		{
+			std::string message = "Linker:";
+
+			auto append = [&](const char* what, const std::vector<String>& tags)
+			{
+				if (tags.empty()) return;
+
+				message += what;
+				for (const auto& tag : tags)
+				{
+					message += " '";
+					message.append(tag.begin(), tag.end());
+					message += "'";
+				}
+			};
+
+			append(" duplicate tags", duplicateTags);
+			append(" missing tags", missingTags);
+
+			return message;
+		}
+
+	public:
+
+		BasicLinkError(std::vector<String> duplicateTags, std::vector<String> missingTags)
+			: std::runtime_error(Describe(duplicateTags, missingTags)),
+			_duplicateTags(std::move(duplicateTags)), _missingTags(std::move(missingTags)) {}
+
+		// tags marked more than once, each listed once in order of their second mark
+		const std::vector<String>& duplicateTags() const
+		{
+			return _duplicateTags;
+		}
+
+		// tags jumped to but never marked, each listed once in order of their first jump
+		const std::vector<String>& missingTags() const
+		{
+			return _missingTags;
+		}
+	};
+
+	// Resolves the string tags of Control::Jump, JumpIf and JumpIfElse to instruction indices:
+	// the jumps become JumpTo, JumpIfTo and JumpIfElseTo, and the Mark instructions are dropped.
+	// A mark resolves to the index of the instruction following it (the sequence size if there is none).
+	template <typename V>
+	class BasicLinker
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+		using Sequence = std::vector<Instruction>;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+
+		using Error = BasicLinkError<String>;
+
+		static Sequence Link(const Sequence& seq)
+		{
+			std::unordered_map<String, Int> targets;
+			std::vector<String> duplicateTags;
+
+			Int index = 0;
+			for (const auto& instruction : seq)
+			{
+				if (instruction.opcode() != OpcodeId::ControlMark)
+				{
+					++index;
+					continue;
+				}
+
+				const auto& tag = std::get<String>(instruction.oprands()[0]);
+				if (!targets.emplace(tag, index).second && std::find(duplicateTags.begin(), duplicateTags.end(), tag) == duplicateTags.end())
+				{
+					duplicateTags.push_back(tag);
+				}
+			}
+
+			std::vector<String> missingTags;
+			auto resolve = [&](const Value& oprand) -> Int
+			{
+				const auto& tag = std::get<String>(oprand);
+				if (auto found = targets.find(tag); found != targets.end()) return found->second;
+
+				if (std::find(missingTags.begin(), missingTags.end(), tag) == missingTags.end())
+				{
+					missingTags.push_back(tag);
+				}
+				return -1;
+			};
+
+			Sequence linked;
+			linked.reserve(static_cast<std::size_t>(index));
+
+			for (const auto& instruction : seq)
+			{
+				const auto& oprands = instruction.oprands();
+
+				switch (instruction.opcode())
+				{
+				case OpcodeId::ControlMark:
+					break;
+				case OpcodeId::ControlJump:
+					linked.push_back(Instruction::Control::JumpTo(resolve(oprands[0])));
+					break;
+				case OpcodeId::ControlJumpIf:
+					linked.push_back(Instruction::Control::JumpIfTo(resolve(oprands[0])));
+					break;
+				case OpcodeId::ControlJumpIfElse:
+				{
+					const auto targetIf = resolve(oprands[0]);
+					linked.push_back(Instruction::Control::JumpIfElseTo(targetIf, resolve(oprands[1])));
+					break;
+				}
+				default:
+					linked.push_back(instruction);
+				}
+			}
+
+			if (!duplicateTags.empty() || !missingTags.empty())
+			{
+				throw Error(std::move(duplicateTags), std::move(missingTags));
+			}
+
+			return linked;
+		}
+	};
+
+	using LinkError = BasicLinkError<IRValue::String>;
+	using Linker = BasicLinker<IRValue>;
+}
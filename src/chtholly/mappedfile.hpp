@@ -0,0 +1,165 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Chtholly
+{
+	// A whole file mapped read-only into memory
+	class MappedFile
+	{
+		const char* _data = nullptr;
+		std::size_t _size = 0;
+
+#ifdef _WIN32
+		HANDLE mapping = nullptr;
+#endif
+
+		void unmap() noexcept
+		{
+#ifdef _WIN32
+			if (_data) UnmapViewOfFile(_data);
+			if (mapping) CloseHandle(mapping);
+			mapping = nullptr;
+#else
+			if (_data) munmap(const_cast<char*>(_data), _size);
+#endif
+			_data = nullptr;
+			_size = 0;
+		}
+
+		[[noreturn]] static void Fail(const std::string& path)
+		{
+			throw std::runtime_error("MappedFile: cannot map '" + path + "'");
+		}
+
+	public:
+
+		MappedFile() = default;
+
+		explicit MappedFile(const std::string& path)
+		{
+#ifdef _WIN32
+			auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) Fail(path);
+
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size))
+			{
+				CloseHandle(file);
+				Fail(path);
+			}
+			_size = std::size_t(size.QuadPart);
+
+			// an empty file can't be mapped, it is represented by a null view
+			if (_size > 0)
+			{
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping) _data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			}
+			CloseHandle(file);
+
+			if (_size > 0 && !_data)
+			{
+				unmap();
+				Fail(path);
+			}
+#else
+			const int file = open(path.c_str(), O_RDONLY);
+			if (file < 0) Fail(path);
+
+			struct stat status;
+			if (fstat(file, &status) != 0)
+			{
+				close(file);
+				Fail(path);
+			}
+			_size = std::size_t(status.st_size);
+
+			// an empty file can't be mapped, it is represented by a null view
+			if (_size > 0)
+			{
+				auto mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, file, 0);
+				if (mapped == MAP_FAILED)
+				{
+					close(file);
+					Fail(path);
+				}
+				_data = static_cast<const char*>(mapped);
+			}
+			close(file);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& src) noexcept
+			: _data(std::exchange(src._data, nullptr)), _size(std::exchange(src._size, 0))
+#ifdef _WIN32
+			, mapping(std::exchange(src.mapping, nullptr))
+#endif
+		{}
+
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile& operator=(MappedFile&& src) noexcept
+		{
+			if (this != &src)
+			{
+				unmap();
+				_data = std::exchange(src._data, nullptr);
+				_size = std::exchange(src._size, 0);
+#ifdef _WIN32
+				mapping = std::exchange(src.mapping, nullptr);
+#endif
+			}
+
+			return *this;
+		}
+
+		const char* data() const
+		{
+			return _data;
+		}
+
+		std::size_t size() const
+		{
+			return _size;
+		}
+
+		~MappedFile()
+		{
+			unmap();
+		}
+	};
+}
@@ -0,0 +1,388 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "instruction.hpp"
+#include "blockindex.hpp"
+
+namespace Chtholly
+{
+	// Peephole optimization of an instruction sequence, before it is linked.
+	// The passes are applied together in one scan, each one when a bracket closes,
+	// so that what a pass leaves behind (e.g. a folded operand) is seen by the next brackets:
+	//   unwrapBlocks   Block::Begin, <single value>, Block::End             => <single value>
+	//   dropDeadBlocks Block::Begin, <literals>, Block::Drop                => nothing
+	//   foldOperators  Block::Begin, Object::Use(op), <literals>, Function::Call => <literal>
+	//   foldLiterals   Block::Begin, Object::Use("array.literal" or "dict.literal"), <constants>, Function::Call
+	//                  => Literal::Constant(index), the folded instructions becoming an entry of the constants
+	// foldOperators rests on assumptions until the generator emits operators, which it does not yet
+	// (an AdditiveExpression has no generation): that an operator is called like a function named by it,
+	// and that it means what FoldUnary and FoldBinary say, e.g. Int and Float comparing by value in == and <>,
+	// + concatenating strings and and / or taking bools only. No runtime defines these semantics yet.
+	template <typename V>
+	class BasicOptimizer
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+		using Sequence = std::vector<Instruction>;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+		using Float = typename Value::Float;
+		using Bool = typename Value::Bool;
+
+		using Size = std::size_t;
+
+		struct Options
+		{
+			bool unwrapBlocks = true;
+			bool dropDeadBlocks = true;
+			bool foldOperators = true;
+			bool foldLiterals = true;
+		};
+
+		struct Stats
+		{
+			Size unwrappedBlocks = 0;
+			Size droppedBlocks = 0;
+			Size foldedOperators = 0;
+			Size foldedLiterals = 0;
+
+			Size inputSize = 0;
+			Size outputSize = 0;
+		};
+
+		struct Result
+		{
+			Sequence code;
+
+			// instructions building each value referred to by Literal::Constant, which may refer to earlier entries;
+			// a runtime makes a fresh value from an entry at each evaluation, or shares it if it is never mutated
+			std::vector<Sequence> constants;
+
+			Stats stats;
+		};
+
+	private:
+
+		static bool IsScalarLiteral(const Instruction& instruction)
+		{
+			switch (instruction.opcode())
+			{
+			case OpcodeId::LiteralInt: case OpcodeId::LiteralFloat: case OpcodeId::LiteralString:
+			case OpcodeId::LiteralBool: case OpcodeId::LiteralNull: case OpcodeId::LiteralUndef:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		static bool IsConstant(const Instruction& instruction)
+		{
+			return IsScalarLiteral(instruction) || instruction.opcode() == OpcodeId::LiteralConstant;
+		}
+
+		// pushes exactly one value without any side effect
+		static bool IsSingleValue(const Instruction& instruction)
+		{
+			return IsConstant(instruction) || instruction.opcode() == OpcodeId::ObjectUse;
+		}
+
+		template <typename Iterator, typename Predicate>
+		static bool All(Iterator begin, Iterator end, Predicate predicate)
+		{
+			for (; begin != end; ++begin)
+			{
+				if (!predicate(*begin)) return false;
+			}
+			return true;
+		}
+
+		static bool Add(Int a, Int b, Int& result)
+		{
+			if ((b > 0 && a > std::numeric_limits<Int>::max() - b) || (b < 0 && a < std::numeric_limits<Int>::min() - b)) return false;
+			result = a + b;
+			return true;
+		}
+
+		static bool Subtract(Int a, Int b, Int& result)
+		{
+			if ((b < 0 && a > std::numeric_limits<Int>::max() + b) || (b > 0 && a < std::numeric_limits<Int>::min() + b)) return false;
+			result = a - b;
+			return true;
+		}
+
+		static bool Multiply(Int a, Int b, Int& result)
+		{
+			constexpr auto max = std::numeric_limits<Int>::max(), min = std::numeric_limits<Int>::min();
+
+			if (a == 0 || b == 0)
+			{
+				result = 0;
+				return true;
+			}
+			if (a > 0 ? (b > 0 ? a > max / b : b < min / a) : (b > 0 ? a < min / b : a < max / b)) return false;
+
+			result = a * b;
+			return true;
+		}
+
+		static std::optional<Float> AsFloat(const Value& value)
+		{
+			if (auto v = std::get_if<Float>(&value)) return *v;
+			if (auto v = std::get_if<Int>(&value)) return Float(*v);
+			return std::nullopt;
+		}
+
+		template <typename Compare>
+		static std::optional<Instruction> FoldCompare(const Value& lhs, const Value& rhs, Compare compare)
+		{
+			auto a = std::get_if<Int>(&lhs), b = std::get_if<Int>(&rhs);
+			if (a && b) return Instruction::Literal::Bool(compare(*a, *b));
+
+			auto x = AsFloat(lhs), y = AsFloat(rhs);
+			if (x && y) return Instruction::Literal::Bool(compare(*x, *y));
+
+			return std::nullopt;
+		}
+
+		static std::optional<Instruction> FoldUnary(std::string_view op, const Value& value)
+		{
+			if (op == "not")
+			{
+				if (auto v = std::get_if<Bool>(&value)) return Instruction::Literal::Bool(!*v);
+			}
+			else if (op == "+" || op == "-")
+			{
+				const bool negate = op == "-";
+
+				if (auto v = std::get_if<Int>(&value))
+				{
+					if (!negate) return Instruction::Literal::Int(*v);
+					if (*v != std::numeric_limits<Int>::min()) return Instruction::Literal::Int(-*v);
+				}
+				if (auto v = std::get_if<Float>(&value)) return Instruction::Literal::Float(negate ? -*v : *v);
+			}
+
+			return std::nullopt;
+		}
+
+		// integer division and remainder are left to the runtime, whose rounding is not fixed here
+		static std::optional<Instruction> FoldBinary(std::string_view op, const Value& lhs, const Value& rhs)
+		{
+			if (op == "and" || op == "or")
+			{
+				auto a = std::get_if<Bool>(&lhs), b = std::get_if<Bool>(&rhs);
+				if (a && b) return Instruction::Literal::Bool(op == "and" ? *a && *b : *a || *b);
+				return std::nullopt;
+			}
+
+			if (op == "==" || op == "<>")
+			{
+				// only scalars of the same kind are compared here, numbers of mixed kinds go below
+				if (lhs.index() == rhs.index()) return Instruction::Literal::Bool((lhs == rhs) == (op == "=="));
+				if (auto result = FoldCompare(lhs, rhs, [](auto a, auto b) { return a == b; }))
+				{
+					return op == "==" ? result : Instruction::Literal::Bool(!std::get<Bool>(result->oprands()[0]));
+				}
+				return std::nullopt;
+			}
+
+			if (op == "<") return FoldCompare(lhs, rhs, [](auto a, auto b) { return a < b; });
+			if (op == "<=") return FoldCompare(lhs, rhs, [](auto a, auto b) { return a <= b; });
+			if (op == ">") return FoldCompare(lhs, rhs, [](auto a, auto b) { return a > b; });
+			if (op == ">=") return FoldCompare(lhs, rhs, [](auto a, auto b) { return a >= b; });
+
+			if (op == "+")
+			{
+				auto s = std::get_if<String>(&lhs), t = std::get_if<String>(&rhs);
+				if (s && t) return Instruction::Literal::String(*s + *t);
+			}
+
+			auto a = std::get_if<Int>(&lhs), b = std::get_if<Int>(&rhs);
+			if (a && b)
+			{
+				Int result;
+				if ((op == "+" && Add(*a, *b, result)) || (op == "-" && Subtract(*a, *b, result)) || (op == "*" && Multiply(*a, *b, result)))
+				{
+					return Instruction::Literal::Int(result);
+				}
+				return std::nullopt;
+			}
+
+			auto x = AsFloat(lhs), y = AsFloat(rhs);
+			if (x && y)
+			{
+				if (op == "+") return Instruction::Literal::Float(*x + *y);
+				if (op == "-") return Instruction::Literal::Float(*x - *y);
+				if (op == "*") return Instruction::Literal::Float(*x * *y);
+				if (op == "/") return Instruction::Literal::Float(*x / *y);
+			}
+
+			return std::nullopt;
+		}
+
+		static Value OprandOf(const Instruction& literal)
+		{
+			switch (literal.opcode())
+			{
+			case OpcodeId::LiteralNull: return typename Value::Null{};
+			case OpcodeId::LiteralUndef: return typename Value::Undef{};
+			default: return literal.oprands()[0];
+			}
+		}
+
+		struct Open
+		{
+			// where the opener stands in the output, and in the input for the diagnostics
+			Size position;
+			OpcodeId opcode;
+			Size index;
+		};
+
+		// rewrite the bracket closed by closer whose opener is at out[open.position]; false to keep it as it is
+		static bool Rewrite(const Options& options, Result& result, const Open& open, const Instruction& closer)
+		{
+			auto& out = result.code;
+			auto& stats = result.stats;
+
+			if (open.opcode != OpcodeId::BlockBegin) return false;
+
+			const auto body = out.begin() + open.position + 1;
+			const auto bodySize = Size(out.end() - body);
+
+			switch (closer.opcode())
+			{
+			case OpcodeId::BlockEnd:
+				if (options.unwrapBlocks && bodySize == 1 && IsSingleValue(*body))
+				{
+					out[open.position] = *body;
+					out.pop_back();
+					++stats.unwrappedBlocks;
+					return true;
+				}
+				return false;
+
+			case OpcodeId::BlockDrop:
+				if (options.dropDeadBlocks && All(body, out.end(), IsConstant))
+				{
+					out.erase(body - 1, out.end());
+					++stats.droppedBlocks;
+					return true;
+				}
+				return false;
+
+			case OpcodeId::FunctionCall:
+			{
+				if (bodySize == 0 || body->opcode() != OpcodeId::ObjectUse) return false;
+
+				const auto& function = std::get<String>(body->oprands()[0]);
+				const auto args = body + 1;
+				const auto argCount = bodySize - 1;
+
+				if (options.foldLiterals && (function == "array.literal" || function == "dict.literal") && All(args, out.end(), IsConstant))
+				{
+					Sequence entry(body - 1, out.end());
+					entry.push_back(closer);
+					result.constants.push_back(std::move(entry));
+
+					out.erase(body - 1, out.end());
+					out.push_back(Instruction::Literal::Constant(Int(result.constants.size() - 1)));
+					++stats.foldedLiterals;
+					return true;
+				}
+
+				if (options.foldOperators && (argCount == 1 || argCount == 2) && All(args, out.end(), IsScalarLiteral))
+				{
+					const auto folded = argCount == 1
+						? FoldUnary(function, OprandOf(args[0]))
+						: FoldBinary(function, OprandOf(args[0]), OprandOf(args[1]));
+					if (!folded) return false;
+
+					out.erase(body - 1, out.end());
+					out.push_back(*folded);
+					++stats.foldedOperators;
+					return true;
+				}
+				return false;
+			}
+
+			default:
+				return false;
+			}
+		}
+
+	public:
+
+		static Result Optimize(const Sequence& seq, const Options& options = {})
+		{
+			Result result;
+			result.stats.inputSize = seq.size();
+			result.code.reserve(seq.size());
+
+			std::vector<Open> open;
+
+			for (Size i = 0; i < seq.size(); ++i)
+			{
+				const auto& instruction = seq[i];
+				const auto code = instruction.opcode();
+
+				if (code == OpcodeId::ControlJumpTo || code == OpcodeId::ControlJumpIfTo || code == OpcodeId::ControlJumpIfElseTo)
+				{
+					throw std::invalid_argument("Optimizer: the sequence is already linked");
+				}
+
+				const auto bracket = BracketOf(code);
+				if (bracket.kind != BracketKind::none && !bracket.opening)
+				{
+					if (open.empty()) throw std::invalid_argument("Optimizer: unmatched closing bracket at instruction " + std::to_string(i));
+					if (BracketOf(open.back().opcode).kind != bracket.kind) throw std::invalid_argument("Optimizer: mismatched closing bracket at instruction " + std::to_string(i));
+
+					const auto opener = open.back();
+					open.pop_back();
+
+					if (Rewrite(options, result, opener, instruction)) continue;
+				}
+
+				if (bracket.kind != BracketKind::none && bracket.opening)
+				{
+					open.push_back({ result.code.size(), code, i });
+				}
+
+				result.code.push_back(instruction);
+			}
+
+			if (!open.empty()) throw std::invalid_argument("Optimizer: unclosed bracket at instruction " + std::to_string(open.back().index));
+
+			result.stats.outputSize = result.code.size();
+			return result;
+		}
+	};
+
+	using Optimizer = BasicOptimizer<IRValue>;
+}
@@ -0,0 +1,446 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "instruction.hpp"
+#include "symboltable.hpp"
+
+namespace Chtholly
+{
+	enum class OperandKind : std::uint8_t
+	{
+		none,
+		undef,
+		null,
+		boolean,
+		integer,      // inline, sign-extended from the slot width
+		integerPool,  // index into the integer pool
+		floating,     // inline bits, only in the 64-bit slot
+		floatingPool, // index into the float pool
+		string,       // index into the string pool
+		symbol        // id in the symbol table of the sequence
+	};
+
+	// A fixed-size instruction: the first operand is held in the 64-bit slot,
+	// the second one in the 32-bit slot; what does not fit goes to the constant pool
+	struct PackedInstruction
+	{
+		inline static constexpr std::size_t maxOprands = 2;
+
+		OpcodeId opcode = OpcodeId::None;
+		std::uint8_t size = 0;
+		OperandKind kinds[maxOprands] = { OperandKind::none, OperandKind::none };
+		std::uint32_t second = 0;
+		std::uint64_t first = 0;
+
+		bool operator==(const PackedInstruction& other) const
+		{
+			return opcode == other.opcode && size == other.size &&
+				kinds[0] == other.kinds[0] && kinds[1] == other.kinds[1] &&
+				first == other.first && second == other.second;
+		}
+		bool operator!=(const PackedInstruction& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	static_assert(sizeof(PackedInstruction) == 16);
+
+	// Strings (interned), integers and floats which do not fit inline in a PackedInstruction
+	template <typename V>
+	class BasicConstantPool
+	{
+	public:
+
+		using Value = V;
+
+		using Index = std::uint32_t;
+		using Size = std::size_t;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+		using Float = typename Value::Float;
+
+		using StringView = std::basic_string_view<typename String::value_type>;
+
+	private:
+
+		BasicSymbolTable<String> strings;
+
+		std::vector<Int> ints;
+		std::vector<Float> floats;
+
+		static Index CheckIndex(Size size)
+		{
+			if (size >= std::numeric_limits<Index>::max())
+			{
+				throw std::length_error("ConstantPool: too many constants");
+			}
+
+			return static_cast<Index>(size);
+		}
+
+	public:
+
+		Index addString(StringView value)
+		{
+			return strings.intern(value);
+		}
+
+		Index addInt(Int value)
+		{
+			const auto index = CheckIndex(ints.size());
+			ints.push_back(value);
+
+			return index;
+		}
+
+		Index addFloat(Float value)
+		{
+			const auto index = CheckIndex(floats.size());
+			floats.push_back(value);
+
+			return index;
+		}
+
+		StringView string(Index index) const
+		{
+			return strings.name(index);
+		}
+
+		Int integer(Index index) const
+		{
+			return ints.at(index);
+		}
+
+		Float floating(Index index) const
+		{
+			return floats.at(index);
+		}
+
+		Size stringCount() const
+		{
+			return strings.size();
+		}
+
+		Size intCount() const
+		{
+			return ints.size();
+		}
+
+		Size floatCount() const
+		{
+			return floats.size();
+		}
+
+		~BasicConstantPool() = default;
+	};
+
+	// Operand decoding shared by the packed forms of a sequence.
+	// Derived provides integer, floating, string and symbol lookups by index, operator[] and size()
+	template <typename Derived, typename V>
+	class BasicPackedReader
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+
+		using Size = std::size_t;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+		using Float = typename Value::Float;
+		using StringView = std::basic_string_view<typename String::value_type>;
+
+	private:
+
+		const Derived& derived() const
+		{
+			return static_cast<const Derived&>(*this);
+		}
+
+		template <typename Slot>
+		Value decode(OperandKind kind, Slot slot) const
+		{
+			switch (kind)
+			{
+			case OperandKind::undef: return typename Value::Undef{};
+			case OperandKind::null: return typename Value::Null{};
+			case OperandKind::boolean: return typename Value::Bool(slot != 0);
+			case OperandKind::integer: return Int(static_cast<std::make_signed_t<Slot>>(slot));
+			case OperandKind::integerPool: return derived().integer(static_cast<std::uint32_t>(slot));
+			case OperandKind::floating:
+				// stored inline only in a slot as wide as a float, as encode does
+				if constexpr (sizeof(Slot) == sizeof(Float))
+				{
+					Float value;
+					std::memcpy(&value, &slot, sizeof(Float));
+					return value;
+				}
+				else
+				{
+					throw std::invalid_argument("PackedSequence: inline float in a narrow slot");
+				}
+			case OperandKind::floatingPool: return derived().floating(static_cast<std::uint32_t>(slot));
+			case OperandKind::string: return String(derived().string(static_cast<std::uint32_t>(slot)));
+			case OperandKind::symbol: return String(derived().symbol(static_cast<SymbolId>(slot)));
+			default: throw std::invalid_argument("PackedSequence: bad operand kind");
+			}
+		}
+
+	public:
+
+		Value operand(const PackedInstruction& packed, Size index) const
+		{
+			if (index >= packed.size)
+			{
+				throw std::out_of_range("PackedSequence: operand index out of range");
+			}
+
+			return index == 0 ? decode(packed.kinds[0], packed.first) : decode(packed.kinds[1], packed.second);
+		}
+
+		// the string or symbol operand without copying it out of the pool
+		StringView stringOperand(const PackedInstruction& packed, Size index) const
+		{
+			if (index < packed.size && packed.kinds[index] == OperandKind::symbol)
+			{
+				return derived().symbol(symbolOperand(packed, index));
+			}
+			if (index >= packed.size || packed.kinds[index] != OperandKind::string)
+			{
+				throw std::invalid_argument("PackedSequence: operand is not a string");
+			}
+
+			return derived().string(static_cast<std::uint32_t>(index == 0 ? packed.first : packed.second));
+		}
+
+		SymbolId symbolOperand(const PackedInstruction& packed, Size index) const
+		{
+			if (index >= packed.size || packed.kinds[index] != OperandKind::symbol)
+			{
+				throw std::invalid_argument("PackedSequence: operand is not a symbol");
+			}
+
+			return static_cast<SymbolId>(index == 0 ? packed.first : packed.second);
+		}
+
+		Instruction unpack(Size index) const
+		{
+			if (index >= derived().size())
+			{
+				throw std::out_of_range("PackedSequence: instruction index out of range");
+			}
+
+			const auto& packed = derived()[index];
+
+			std::vector<Value> oprands;
+			oprands.reserve(packed.size);
+			for (Size i = 0; i < packed.size; ++i)
+			{
+				oprands.push_back(operand(packed, i));
+			}
+
+			return Instruction::Make(packed.opcode, std::move(oprands));
+		}
+
+		std::vector<Instruction> unpack() const
+		{
+			std::vector<Instruction> seq;
+			seq.reserve(derived().size());
+			for (Size i = 0; i < derived().size(); ++i)
+			{
+				seq.push_back(unpack(i));
+			}
+
+			return seq;
+		}
+	};
+
+	// A sequence of PackedInstruction with its constant pool and symbol table,
+	// convertible to and from a sequence of BasicInstruction.
+	// Identifier operands (see HasSymbolOprands) are interned as symbols, so comparing two names is comparing two ids
+	template <typename V>
+	class BasicPackedSequence : public BasicPackedReader<BasicPackedSequence<V>, V>
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+		using Pool = BasicConstantPool<Value>;
+
+		using Index = typename Pool::Index;
+		using Size = std::size_t;
+
+		using String = typename Value::String;
+		using Int = typename Value::Int;
+		using Float = typename Value::Float;
+		using StringView = typename Pool::StringView;
+		using Symbols = BasicSymbolTable<String>;
+
+	private:
+
+		std::vector<PackedInstruction> code;
+		Pool pool;
+		Symbols symbolTable;
+
+		template <typename Slot>
+		OperandKind encode(const Value& value, Slot& slot, bool symbol)
+		{
+			constexpr bool wide = sizeof(Slot) >= sizeof(Int);
+
+			if (std::get_if<typename Value::Undef>(&value))
+			{
+				return OperandKind::undef;
+			}
+			if (std::get_if<typename Value::Null>(&value))
+			{
+				return OperandKind::null;
+			}
+			if (auto v = std::get_if<typename Value::Bool>(&value))
+			{
+				slot = *v ? 1 : 0;
+				return OperandKind::boolean;
+			}
+			if (auto v = std::get_if<Int>(&value))
+			{
+				using Signed = std::make_signed_t<Slot>;
+				if (wide || (*v >= std::numeric_limits<Signed>::min() && *v <= std::numeric_limits<Signed>::max()))
+				{
+					slot = static_cast<Slot>(*v);
+					return OperandKind::integer;
+				}
+
+				slot = pool.addInt(*v);
+				return OperandKind::integerPool;
+			}
+			if (auto v = std::get_if<Float>(&value))
+			{
+				if constexpr (sizeof(Slot) == sizeof(Float))
+				{
+					std::memcpy(&slot, v, sizeof(Float));
+					return OperandKind::floating;
+				}
+				else
+				{
+					slot = pool.addFloat(*v);
+					return OperandKind::floatingPool;
+				}
+			}
+
+			if (symbol)
+			{
+				slot = symbolTable.intern(std::get<String>(value));
+				return OperandKind::symbol;
+			}
+
+			slot = pool.addString(std::get<String>(value));
+			return OperandKind::string;
+		}
+
+	public:
+
+		BasicPackedSequence() = default;
+
+		explicit BasicPackedSequence(const std::vector<Instruction>& seq)
+		{
+			code.reserve(seq.size());
+			for (const auto& instruction : seq)
+			{
+				push_back(instruction);
+			}
+		}
+
+		void push_back(const Instruction& instruction)
+		{
+			const auto& oprands = instruction.oprands();
+			if (oprands.size() > PackedInstruction::maxOprands)
+			{
+				throw std::length_error("PackedSequence: too many operands");
+			}
+
+			PackedInstruction packed;
+			packed.opcode = instruction.opcode();
+			packed.size = static_cast<std::uint8_t>(oprands.size());
+
+			const auto symbol = HasSymbolOprands(packed.opcode);
+			if (oprands.size() > 0) packed.kinds[0] = encode(oprands[0], packed.first, symbol);
+			if (oprands.size() > 1) packed.kinds[1] = encode(oprands[1], packed.second, symbol);
+
+			code.push_back(packed);
+		}
+
+		const std::vector<PackedInstruction>& instructions() const
+		{
+			return code;
+		}
+
+		const PackedInstruction& operator[](Size index) const
+		{
+			return code[index];
+		}
+
+		Int integer(Index index) const
+		{
+			return pool.integer(index);
+		}
+
+		Float floating(Index index) const
+		{
+			return pool.floating(index);
+		}
+
+		StringView string(Index index) const
+		{
+			return pool.string(index);
+		}
+
+		StringView symbol(SymbolId id) const
+		{
+			return symbolTable.name(id);
+		}
+
+		const Pool& constants() const
+		{
+			return pool;
+		}
+
+		const Symbols& symbols() const
+		{
+			return symbolTable;
+		}
+
+		Size size() const
+		{
+			return code.size();
+		}
+
+		~BasicPackedSequence() = default;
+	};
+
+	using ConstantPool = BasicConstantPool<IRValue>;
+	using PackedSequence = BasicPackedSequence<IRValue>;
+}
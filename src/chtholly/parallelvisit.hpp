@@ -0,0 +1,82 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "threadpool.hpp"
+
+namespace Chtholly
+{
+	// Visit the subtrees selected under root as parallel tasks on the pool,
+	// then merge their results into init in pre-order, so the result doesn't depend on scheduling.
+	// The subtrees selected must be independent: select isn't called under a selected node,
+	// and visit may only read the tree (it may call ParallelVisit itself, on the same pool).
+	template <typename Result, typename Observer, typename Select, typename Visit, typename Merge>
+	Result ParallelVisit(ThreadPool& pool, const Observer& root, Select&& select, Visit&& visit, Merge&& merge, Result init = {})
+	{
+		std::vector<Observer> selected;
+		for (std::vector<Observer> pending{ root }; !pending.empty();)
+		{
+			auto current = pending.back();
+			pending.pop_back();
+
+			if (select(current))
+			{
+				selected.push_back(current);
+				continue;
+			}
+
+			for (auto child = current.childrenEnd(); child != current.childrenBegin();) pending.push_back(--child);
+		}
+
+		std::vector<std::optional<Result>> results(selected.size());
+		{
+			TaskGroup group(pool);
+			for (std::size_t i = 0; i < selected.size(); ++i)
+			{
+				group.run([&, i] { results[i].emplace(visit(selected[i])); });
+			}
+			group.wait();
+		}
+
+		for (auto& result : results) init = merge(std::move(init), std::move(*result));
+		return init;
+	}
+
+	// Visit the children of parent as parallel tasks
+	template <typename Result, typename Observer, typename Visit, typename Merge>
+	Result ParallelVisitChildren(ThreadPool& pool, const Observer& parent, Visit&& visit, Merge&& merge, Result init = {})
+	{
+		std::vector<std::optional<Result>> results(parent.childrenSize());
+		{
+			TaskGroup group(pool);
+
+			std::size_t i = 0;
+			for (auto child = parent.childrenBegin(); child != parent.childrenEnd(); ++child, ++i)
+			{
+				group.run([&, child, i] { results[i].emplace(visit(child)); });
+			}
+			group.wait();
+		}
+
+		for (auto& result : results) init = merge(std::move(init), std::move(*result));
+		return init;
+	}
+}
@@ -0,0 +1,336 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "parsetree.hpp"
+
+namespace Chtholly
+{
+	// What the parser may inspect of a child which is already built:
+	// the child itself and the end of the chain of single children under it
+	template <typename Unit>
+	struct BasicBuiltChild
+	{
+		using Type = typename Unit::Type;
+		using Name = typename Unit::Name;
+
+		Type type;
+		Name name;
+
+		Type leafType;
+		Name leafName;
+		std::size_t leafChildrenSize;
+	};
+
+	// Builder policy of the parser which builds a tree through its Modifier.
+	// A builder policy defines the Cursor type carried by the parser and how the parser moves it:
+	// PushToken, EnterTerm, LeaveTerm, EraseBackChild, ChildrenSize and BackChild
+	template <typename inTree>
+	struct BasicTreeBuilder
+	{
+		using Tree = inTree;
+		using Cursor = typename Tree::Modifier;
+
+		using Unit = typename Tree::Unit;
+		using UnitName = typename Unit::Name;
+		using UnitType = typename Unit::Type;
+		using StringView = typename Unit::StringView;
+
+		using BuiltChild = BasicBuiltChild<Unit>;
+		using Size = std::size_t;
+
+		static Cursor PushToken(Cursor cursor, const UnitName& name, const StringView& value)
+		{
+			cursor.childrenPushBack(UnitType::token, name, value);
+			return cursor;
+		}
+
+		static Cursor EnterTerm(Cursor cursor, const UnitName& name)
+		{
+			cursor.childrenPushBack(UnitType::term, name);
+			return --cursor.childrenEnd();
+		}
+
+		// Leave the term under cursor; if it has less than minAllowedChildSize children,
+		// it is replaced by its children
+		static Cursor LeaveTerm(Cursor cursor, Size minAllowedChildSize = 0)
+		{
+			if (minAllowedChildSize > cursor.childrenSize())
+			{
+				for (auto moved = cursor.childrenBegin(); moved != cursor.childrenEnd();)
+				{
+					auto next = moved.thisNext();
+					moved.thisMoveTo(cursor);
+					moved = next;
+				}
+
+				auto parent = cursor.parent();
+				cursor.thisErase(cursor);
+				return parent;
+			}
+
+			return cursor.parent();
+		}
+
+		static Cursor EraseBackChild(Cursor cursor)
+		{
+			auto erased = --cursor.childrenEnd();
+			erased.thisErase(erased);
+			return cursor;
+		}
+
+		static Size ChildrenSize(const Cursor& cursor)
+		{
+			return cursor.childrenSize();
+		}
+
+		// index-th child counted from the back
+		static BuiltChild BackChild(const Cursor& cursor, Size index = 0)
+		{
+			auto child = --cursor.childrenEnd();
+			while (index-- > 0) --child;
+
+			auto leaf = child;
+			while (leaf.childrenSize() == 1) leaf = leaf.childrenBegin();
+
+			return { child.value().type, child.value().name, leaf.value().type, leaf.value().name, leaf.childrenSize() };
+		}
+	};
+
+	// Builder policy of the parser which reports the tree as events to a sink instead of building it.
+	// A sink provides:
+	//   enterTerm(name)          a term is opened under the current term
+	//   token(name, value)       a token is appended to the current term
+	//   exitTerm(collapsed)      the current term is closed; if collapsed, it is replaced by its children
+	//   discard()                the last child of the current term is removed
+	// Only a summary of the children of the open terms is kept, so that the parser can still inspect them.
+	template <typename inStringView, typename inSink>
+	struct BasicEventBuilder
+	{
+		using Sink = inSink;
+
+		using Unit = BasicParseUnit<inStringView>;
+		using UnitName = typename Unit::Name;
+		using UnitType = typename Unit::Type;
+		using StringView = typename Unit::StringView;
+
+		using BuiltChild = BasicBuiltChild<Unit>;
+		using Size = std::size_t;
+
+		class Context;
+
+		// A position of the parser, i.e. the depth of the current term.
+		// The parser doesn't roll back a failed alternative, it only goes on with an earlier cursor:
+		// terms opened deeper than an earlier cursor are abandoned and closed as they are, just like in a tree.
+		class Cursor
+		{
+			Context* context = nullptr;
+			Size depth = 0;
+
+			Cursor(Context* inContext, Size inDepth) : context(inContext), depth(inDepth) {}
+
+			friend struct BasicEventBuilder<inStringView, inSink>;
+			friend class Context;
+
+		public:
+
+			Cursor() = default;
+
+			bool operator==(const Cursor& other) const
+			{
+				return context == other.context && depth == other.depth;
+			}
+			bool operator!=(const Cursor& other) const
+			{
+				return !(*this == other);
+			}
+		};
+
+		class Context
+		{
+			struct Frame
+			{
+				UnitName name;
+				Size firstChild;
+			};
+
+			Sink& sink;
+
+			// children of all open terms, the children of a term follow the ones of its parent
+			std::vector<BuiltChild> children;
+			std::vector<Frame> frames;
+
+			// close the terms abandoned by an earlier cursor
+			void sync(Size depth)
+			{
+				while (frames.size() > depth + 1) close(0);
+			}
+
+			void close(Size minAllowedChildSize)
+			{
+				const auto frame = frames.back();
+				frames.pop_back();
+
+				const auto size = children.size() - frame.firstChild;
+				if (minAllowedChildSize > size)
+				{
+					// the children of the term are already in place of it
+					sink.exitTerm(true);
+					return;
+				}
+
+				BuiltChild built{ UnitType::term, frame.name, UnitType::term, frame.name, size };
+				if (size == 1)
+				{
+					const auto& only = children.back();
+					built.leafType = only.leafType;
+					built.leafName = only.leafName;
+					built.leafChildrenSize = only.leafChildrenSize;
+				}
+
+				children.erase(children.begin() + frame.firstChild, children.end());
+				children.push_back(built);
+				sink.exitTerm(false);
+			}
+
+			friend struct BasicEventBuilder<inStringView, inSink>;
+
+		public:
+
+			// events are reported as children of an implicit root term
+			explicit Context(Sink& eventSink) : sink(eventSink), frames{ { BasicParseTree<StringView>::rootName, 0 } } {}
+
+			Context(const Context&) = delete;
+
+			Context& operator=(const Context&) = delete;
+
+			Cursor cursor()
+			{
+				return { this, 0 };
+			}
+
+			// close every term left open, the sink is then back to the implicit root
+			void finish()
+			{
+				sync(0);
+			}
+		};
+
+		static Cursor PushToken(Cursor cursor, const UnitName& name, const StringView& value)
+		{
+			auto& context = *cursor.context;
+			context.sync(cursor.depth);
+
+			context.children.push_back({ UnitType::token, name, UnitType::token, name, 0 });
+			context.sink.token(name, value);
+			return cursor;
+		}
+
+		static Cursor EnterTerm(Cursor cursor, const UnitName& name)
+		{
+			auto& context = *cursor.context;
+			context.sync(cursor.depth);
+
+			context.frames.push_back({ name, context.children.size() });
+			context.sink.enterTerm(name);
+			return { cursor.context, cursor.depth + 1 };
+		}
+
+		static Cursor LeaveTerm(Cursor cursor, Size minAllowedChildSize = 0)
+		{
+			auto& context = *cursor.context;
+			context.sync(cursor.depth);
+
+			context.close(minAllowedChildSize);
+			return { cursor.context, cursor.depth - 1 };
+		}
+
+		static Cursor EraseBackChild(Cursor cursor)
+		{
+			auto& context = *cursor.context;
+			context.sync(cursor.depth);
+
+			context.children.pop_back();
+			context.sink.discard();
+			return cursor;
+		}
+
+		static Size ChildrenSize(const Cursor& cursor)
+		{
+			auto& context = *cursor.context;
+			context.sync(cursor.depth);
+
+			return context.children.size() - context.frames.back().firstChild;
+		}
+
+		static BuiltChild BackChild(const Cursor& cursor, Size index = 0)
+		{
+			auto& context = *cursor.context;
+			context.sync(cursor.depth);
+
+			return context.children[context.children.size() - 1 - index];
+		}
+	};
+
+	// Event sink which builds the tree, the result is the same as the one of BasicTreeBuilder
+	template <typename inTree>
+	class BasicTreeSink
+	{
+	public:
+
+		using Tree = inTree;
+		using Modifier = typename Tree::Modifier;
+
+		using Unit = typename Tree::Unit;
+		using UnitName = typename Unit::Name;
+		using StringView = typename Unit::StringView;
+
+	private:
+
+		using Builder = BasicTreeBuilder<Tree>;
+
+		Modifier current;
+
+	public:
+
+		explicit BasicTreeSink(Modifier root) : current(root) {}
+
+		void enterTerm(const UnitName& name)
+		{
+			current = Builder::EnterTerm(current, name);
+		}
+
+		void token(const UnitName& name, const StringView& value)
+		{
+			Builder::PushToken(current, name, value);
+		}
+
+		void exitTerm(bool collapsed)
+		{
+			current = Builder::LeaveTerm(current, collapsed ? std::numeric_limits<std::size_t>::max() : 0);
+		}
+
+		void discard()
+		{
+			Builder::EraseBackChild(current);
+		}
+	};
+}
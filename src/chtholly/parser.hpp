@@ -30,12 +30,12 @@ namespace Chtholly
 {
 	using namespace std::literals;
 
-	template <typename StringView>
-	class BasicParser : public BasicParserCombinator<StringView>
+	template <typename StringView, typename inBuilder = BasicTreeBuilder<BasicParseTree<StringView>>>
+	class BasicParser : public BasicParserCombinator<StringView, inBuilder>
 	{
 	protected:
 
-		using Super = BasicParserCombinator<StringView>;
+		using Super = BasicParserCombinator<StringView, inBuilder>;
 
 	public:
 
@@ -46,7 +46,7 @@ namespace Chtholly
 		using typename Super::Lang;
 		using typename Super::LangRef;
 
-		using typename Super::Tree;
+		using typename Super::Builder;
 
 		using typename Super::Modifier;
 		using typename Super::ModifierRef;
@@ -101,15 +101,14 @@ namespace Chtholly
 
 		inline static const ModifierChange RemoveFailedBlankTerm = [](Modifier modi)
 		{
-			if (modi.childrenSize() > 0)
-			{
-				auto removed = --modi.childrenEnd();
+			constexpr auto functionExpression = ParseUnitName::Predefined("FunctionExpression");
 
-				auto i = removed;
-				while (i.childrenSize() == 1)  i = i.childrenBegin();
-				if (i.childrenSize() == 0 && i.value().type == Unit::Type::term && i.value().name == "FunctionExpression")
+			if (Builder::ChildrenSize(modi) > 0)
+			{
+				const auto removed = Builder::BackChild(modi);
+				if (removed.leafChildrenSize == 0 && removed.leafType == Unit::Type::term && removed.leafName == functionExpression)
 				{
-					removed.thisErase(removed);
+					return Builder::EraseBackChild(modi);
 				}
 			}
 
@@ -288,12 +287,14 @@ namespace Chtholly
 					~Term(Catch(Match({ ',',';' }), "Separator")),
 					Change([](Modifier modi)
 					{
-						if (modi.childrenSize() < 2) return modi;
-						
-						auto back = --modi.childrenEnd();
-						if(back.value().name == "Separator" && (--back).value().name == "Separator")
+						constexpr auto separator = ParseUnitName::Predefined("Separator");
+
+						if (Builder::ChildrenSize(modi) < 2) return modi;
+
+						// both are the same separator, matched again after the expression following it failed
+						if (Builder::BackChild(modi, 0).name == separator && Builder::BackChild(modi, 1).name == separator)
 						{
-							back.thisErase(back);
+							return Builder::EraseBackChild(modi);
 						}
 
 						return modi;
@@ -752,6 +753,12 @@ namespace Chtholly
 
 	using Parser = BasicParser<ParserCombinator::Lang>;
 
+	using ArenaParser = BasicParser<ParserCombinator::Lang, BasicTreeBuilder<ArenaParseTree>>;
+
+	// Parser reporting events to a Sink instead of building a tree
+	template <typename Sink>
+	using EventParser = BasicParser<ParserCombinator::Lang, BasicEventBuilder<ParserCombinator::Lang, Sink>>;
+
 }
 
 #undef G
\ No newline at end of file
@@ -21,11 +21,12 @@
 #include <algorithm>
 
 #include "parsetree.hpp"
+#include "parsebuilder.hpp"
 
 namespace Chtholly
 {
 
-	template <typename StringView>
+	template <typename StringView, typename inBuilder = BasicTreeBuilder<BasicParseTree<StringView>>>
 	class BasicParserCombinator
 	{
 
@@ -34,9 +35,10 @@ namespace Chtholly
 		using Lang = StringView;
 		using LangRef = const Lang &;
 
-		using Tree = BasicParseTree<StringView>;
+		using Builder = inBuilder;
 
-		using Modifier = typename Tree::Modifier;
+		// the position of the parser in the output, a tree modifier unless events are built
+		using Modifier = typename Builder::Cursor;
 		using ModifierRef = const Modifier &;
 
 		using Info = std::pair<Lang, Modifier>;
@@ -277,12 +279,11 @@ namespace Chtholly
 		}
 
 		// Catch Info(token) then push it to the parseTree
-		static Process Catch(ProcessRef pro, const typename Unit::String& tokenName)
+		static Process Catch(ProcessRef pro, const typename Unit::Name& tokenName)
 		{
 			return Catch(pro, [=](Modifier modi, LangRef lang)
 			{
-				modi.childrenPushBack(Unit::Type::token, tokenName, lang);
-				return modi;
+				return Builder::PushToken(modi, tokenName, lang);
 			});
 		}
 
@@ -299,46 +300,30 @@ namespace Chtholly
 			},true);
 		}
 
-		static ModifierChange IntoTerm(const typename Unit::String& termName)
+		static ModifierChange IntoTerm(const typename Unit::Name& termName)
 		{
 			return [=](Modifier modi)
 			{
-				modi.childrenPushBack(Unit::Type::term, termName);
-				return --modi.childrenEnd();
+				return Builder::EnterTerm(modi, termName);
 			};
 		}
 
 		// Enter a term
-		static Process ChangeIn(const typename Unit::String& termName)
+		static Process ChangeIn(const typename Unit::Name& termName)
 		{
 			return Change(IntoTerm(termName));
 		}
 
 		inline static const ModifierChange OutofTerm = [](Modifier modi)
 		{
-			return modi.parent();
+			return Builder::LeaveTerm(modi);
 		};
 
 		static ModifierChange OutofTermWithCuttingUnused(Size minAllowedChildSize)
 		{
 			return [=](Modifier modi)
 			{
-				if(minAllowedChildSize > modi.childrenSize())
-				{
-					if (modi.childrenSize() != 0)
-					{
-						for (auto moved = modi.childrenBegin(); moved != modi.childrenEnd(); ++moved)
-						{
-							moved.thisCopyTo(modi);
-						}
-					}
-
-					auto parent = modi.parent();
-					modi.thisErase(modi);
-					return parent;
-				}
-
-				return OutofTerm(modi);
+				return Builder::LeaveTerm(modi, minAllowedChildSize);
 			};
 		}
 
@@ -17,10 +17,24 @@
 #pragma once
 
 #include <string_view>
+#include <algorithm>
 #include <string>
 #include <list>
+#include <vector>
+#include <tuple>
+#include <deque>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <cstdint>
 #include <type_traits>
 #include <utility>
+#include <memory>
+#include <functional>
+#include <ostream>
+
+#include "arena.hpp"
 
 namespace Chtholly
 {
@@ -30,12 +44,20 @@ namespace Chtholly
 		return {};
 	}
 
-	template <typename inValueType>
+	inline std::size_t HashCombine(std::size_t seed, std::size_t value)
+	{
+		return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+	}
+
+	template <typename inValueType, typename inAllocator = std::allocator<inValueType>>
 	class BasicTree
 	{
 	public:
 
 		using ValueType = inValueType;
+		using Allocator = inAllocator;
+
+		using Size = std::size_t;
 
 		struct NodeWrapper;
 
@@ -43,7 +65,8 @@ namespace Chtholly
 
 		struct Node
 		{
-			using Container = std::list<Node>;
+			using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+			using Container = std::list<Node, NodeAllocator>;
 
 			using ConstIterator = typename Container::const_iterator;
 			using Iterator = typename Container::iterator;
@@ -55,6 +78,15 @@ namespace Chtholly
 			Iterator parent;
 			Container children;
 
+			// Merkle hash of the subtree, 0 until BasicTree::Hash computes it.
+			// A node with a hash has hashes in its whole subtree, so a change clears it up to the first node without one
+			mutable std::size_t hash = 0;
+
+			static void Invalidate(Iterator node)
+			{
+				for (; node->hash != 0; node = node->parent) node->hash = 0;
+			}
+
 			template <typename ...T, std::enable_if_t<std::is_constructible_v<ValueType, T&&...>,int> = 0>
 			Node(T&& ...args) 
 				: value(std::forward<T>(args)...) {}
@@ -71,11 +103,42 @@ namespace Chtholly
 			Node(Iterator in_parent, Container in_children, T&& ...args)
 				: value(std::forward<T>(args)...), parent(std::move(in_parent)), children(std::move(in_children)) {}
 
+			static NodeAllocator CopiedAllocator(const Container& src)
+			{
+				return std::allocator_traits<NodeAllocator>::select_on_container_copy_construction(src.get_allocator());
+			}
+
+			// Copy the subtree under src into the empty children of dst with an explicit stack.
+			// Parents are set during the copy; self is the position of dst,
+			// a singular iterator if it is not known yet (the caller has to fix the direct children then)
+			static void CopyChildren(Node& dst, Iterator self, const Node& src)
+			{
+				std::vector<std::tuple<Node*, Iterator, const Node*>> pending{ { &dst, self, &src } };
+
+				while (!pending.empty())
+				{
+					auto [to, toIter, from] = pending.back();
+					pending.pop_back();
+
+					for (const auto& child : from->children)
+					{
+						auto copied = to->children.emplace(to->children.end(), toIter, Container(to->children.get_allocator()), child.value);
+						if (!child.children.empty()) pending.emplace_back(&*copied, copied, &child);
+					}
+				}
+			}
+
 			Node(const Node& src)
-				: value(src.value), parent(src.parent), children(src.children) {}
+				: value(src.value), parent(src.parent), children(CopiedAllocator(src.children))
+			{
+				CopyChildren(*this, Iterator(), src);
+			}
 
 			Node(Iterator in_parent, const Node& src)
-				: value(src.value), parent(in_parent), children(src.children) {}
+				: value(src.value), parent(in_parent), children(CopiedAllocator(src.children))
+			{
+				CopyChildren(*this, Iterator(), src);
+			}
 
 			Node(const Container& in_container, const Node& src)
 				: value(src.value), parent(src.parent), children(in_container) {}
@@ -91,6 +154,7 @@ namespace Chtholly
 				value = src.value;
 				parent = src.parent;
 				children = src.children;
+				hash = 0;
 
 				return *this;
 			}
@@ -100,13 +164,33 @@ namespace Chtholly
 				value = std::move(src.value);
 				parent = std::move(src.parent);
 				children = std::move(src.children);
+				hash = src.hash;
 
 				return *this;
 			}
 
 			bool operator==(const Node& other) const
 			{
-				return value == other.value && children == other.children;
+				std::vector<std::pair<const Node*, const Node*>> pending{ { this, &other } };
+
+				while (!pending.empty())
+				{
+					auto [lhs, rhs] = pending.back();
+					pending.pop_back();
+
+					// known hashes settle most comparisons at once
+					if (lhs == rhs) continue;
+					if (lhs->hash != 0 && rhs->hash != 0 && lhs->hash != rhs->hash) return false;
+
+					if (!(lhs->value == rhs->value) || lhs->children.size() != rhs->children.size()) return false;
+
+					for (auto i = lhs->children.begin(), j = rhs->children.begin(); i != lhs->children.end(); ++i, ++j)
+					{
+						pending.emplace_back(&*i, &*j);
+					}
+				}
+
+				return true;
 			}
 
 			bool operator!=(const Node& other) const
@@ -114,9 +198,22 @@ namespace Chtholly
 				return !(*this == other);
 			}
 
+			// Flatten the subtree before destroying it, so that destruction doesn't recurse
+			~Node()
+			{
+				Container pending(children.get_allocator());
+				pending.splice(pending.end(), children);
+
+				while (!pending.empty())
+				{
+					pending.splice(pending.end(), pending.front().children);
+					pending.pop_front();
+				}
+			}
 		};
 
 
+		// holds the hidden node, which is its own parent so that walking up the parents always ends
 		typename Node::Container root;
 
 	public:
@@ -152,7 +249,7 @@ namespace Chtholly
 				return *nodeIter;
 			}
 
-			friend class BasicTree<ValueType>;
+			friend class BasicTree;
 
 		public:
 
@@ -203,7 +300,7 @@ namespace Chtholly
 
 			Observer parent() const
 			{
-				return nodeIter->parent;
+				return Observer(Iterator(nodeIter->parent));
 			}
 
 			Observer thisBegin() const
@@ -273,7 +370,7 @@ namespace Chtholly
 				return *nodeIter;
 			}
 
-			friend class BasicTree<ValueType>;
+			friend class BasicTree;
 
 		public:
 
@@ -356,13 +453,16 @@ namespace Chtholly
 			{
 				return nodeIter->value;
 			}
+			// a value given out for writing clears the hashes it is part of
 			ValueType& value()
 			{
+				Node::Invalidate(nodeIter);
 				return nodeIter->value;
 			}
 
 			ValueType& childrenFrontValue()
 			{
+				Node::Invalidate(nodeIter->children.begin());
 				return nodeIter->children.front().value;
 			}
 			const ValueType& childrenFrontValue() const
@@ -371,6 +471,7 @@ namespace Chtholly
 			}
 			ValueType& childrenBackValue()
 			{
+				Node::Invalidate(std::prev(nodeIter->children.end()));
 				return nodeIter->children.back().value;
 			}
 			const ValueType& childrenBackValue() const
@@ -415,7 +516,7 @@ namespace Chtholly
 				return *this;
 			}
 
-			friend class BasicTree<ValueType>;
+			friend class BasicTree;
 
 		public:
 
@@ -483,53 +584,83 @@ namespace Chtholly
 
 			void childrenClear()
 			{
+				Node::Invalidate(nodeIter);
 				nodeIter->children.clear();
 			}
 
+			// A new node gets an empty children list sharing the allocator of its siblings
+			template <typename ...T>
+			static Iterator EmplaceChild(Iterator parent, typename Node::ConstIterator pos, T&& ...inValue)
+			{
+				Node::Invalidate(parent);
+				auto& children = parent->children;
+
+				if constexpr (std::is_constructible_v<ValueType, T&&...>)
+				{
+					return children.emplace(pos, parent, typename Node::Container(children.get_allocator()), std::forward<T>(inValue)...);
+				}
+				else
+				{
+					return children.emplace(pos, parent, std::forward<T>(inValue)...);
+				}
+			}
+
 			template <typename ...T, std::enable_if_t<std::is_constructible_v<Node, T&&...>, int> = 0>
 			void childrenPushFront(T&& ...inValue)
 			{
-				nodeIter->children.emplace_front(nodeIter, std::forward<T>(inValue)...);
+				EmplaceChild(nodeIter, nodeIter->children.begin(), std::forward<T>(inValue)...);
 				BasicTree::FixParent({ childrenBegin() });
 			}
 
 			void childrenPopFront()
 			{
+				Node::Invalidate(nodeIter);
 				nodeIter->children.pop_front();
 			}
 
 			template <typename ...T, std::enable_if_t<std::is_constructible_v<Node, T&&...>, int> = 0>
 			void childrenPushBack(T&& ...inValue)
 			{
-				nodeIter->children.emplace_back(nodeIter, std::forward<T>(inValue)...);
+				EmplaceChild(nodeIter, nodeIter->children.end(), std::forward<T>(inValue)...);
 				BasicTree::FixParent({ --childrenEnd() });
 			}
 
 			void childrenPopBack()
 			{
+				Node::Invalidate(nodeIter);
 				nodeIter->children.pop_back();
 			}
 
 			template <typename ...T, std::enable_if_t<std::is_constructible_v<Node, T&&...>, int> = 0>
 			void childrenResize(typename Node::Size size, T&& ...inValue)
 			{
-				nodeIter->children.resize(size, Node{ nodeIter, std::forward<T>(inValue)... });
+				Node::Invalidate(nodeIter);
+				if constexpr (std::is_constructible_v<ValueType, T&&...>)
+				{
+					nodeIter->children.resize(size, Node{ nodeIter, typename Node::Container(nodeIter->children.get_allocator()), std::forward<T>(inValue)... });
+				}
+				else
+				{
+					nodeIter->children.resize(size, Node{ nodeIter, std::forward<T>(inValue)... });
+				}
 			}
 
 			template <typename ...T, std::enable_if_t<std::is_constructible_v<Node, T&&...>, int> = 0>
 			Modifier childrenInsert(const Modifier& pos, T&& ...inValue)
 			{
-				auto result = nodeIter->children.emplace(pos.nodeIter, nodeIter, std::forward<T>(inValue)...);
+				auto result = EmplaceChild(nodeIter, pos.nodeIter, std::forward<T>(inValue)...);
 				BasicTree::FixParent(Modifier{ result });
 				return Modifier{ result };
 			}
 
 			Modifier childrenErase(const Modifier& pos)
 			{
+				Node::Invalidate(nodeIter);
 				return Modifier{ nodeIter->children.erase(pos.nodeIter) };
 			}
 			Modifier childrenErase(const Modifier& begin, const Modifier& end)
 			{
+				Node::Invalidate(nodeIter);
 				return nodeIter->children.erase(begin.nodeIter, end.nodeIter);
 			}
 
@@ -587,32 +718,48 @@ namespace Chtholly
 				return modi.thisInsert(modi, nodeIter->children, nodeIter->value);
 			}
 
+			// Relink this node (with its subtree) in front of modi, no node is copied
 			Modifier thisMoveTo(Modifier modi)
 			{
-				auto newModi = thisCopyTo(modi);
-				thisErase(*this);
+				auto newParent = modi.nodeIter->parent;
+
+				Node::Invalidate(nodeIter->parent);
+				Node::Invalidate(newParent);
+				newParent->children.splice(modi.nodeIter, nodeIter->parent->children, nodeIter);
+				nodeIter->parent = newParent;
 
-				return newModi;
+				return *this;
 			}
 
 			~Modifier() = default;
 		};
 
 		template <typename ...T, std::enable_if_t<std::is_constructible_v<Node, T&&...>, int> = 0>
-		BasicTree(T&& ...inValue) : root{ { UnusedConstruct(std::in_place_type<ValueType>) } }
+		BasicTree(T&& ...inValue) : BasicTree(std::allocator_arg, Allocator(), std::forward<T>(inValue)...) {}
+
+		// Every node of the tree is allocated through alloc
+		template <typename ...T, std::enable_if_t<std::is_constructible_v<Node, T&&...>, int> = 0>
+		BasicTree(std::allocator_arg_t, const Allocator& alloc, T&& ...inValue) : root(typename Node::NodeAllocator(alloc))
 		{
+			root.emplace_back(typename Node::Container(typename Node::NodeAllocator(alloc)), UnusedConstruct(std::in_place_type<ValueType>));
+			root.front().parent = root.begin();
 			Modifier(root.begin()).childrenPushBack(std::forward<T>(inValue)...);
 		}
 
-		BasicTree(const BasicTree& src) : root(src.root)
+		// Copy in a single pass, parents are set while the nodes are copied
+		BasicTree(const BasicTree& src) : root(Node::CopiedAllocator(src.root))
 		{
-			FixParent(Modifier{ root.begin() });
+			root.emplace_back(typename Node::Container(root.get_allocator()), src.root.front().value);
+			root.front().parent = root.begin();
+			Node::CopyChildren(root.front(), root.begin(), src.root.front());
 		}
 
 		BasicTree& operator=(const BasicTree& src)
 		{
-			root = src.root;
-			FixParent(root.begin());
+			if (this != &src)
+			{
+				root = std::move(BasicTree(src).root);
+			}
 
 			return *this;
 		}
@@ -640,10 +787,18 @@ namespace Chtholly
 
 		static bool CheckParent(const Observer& vis)
 		{
-			for (auto child = vis.childrenBegin(); child != vis.childrenEnd(); ++child)
+			std::vector<Observer> pending{ vis };
+
+			while (!pending.empty())
 			{
-				if (child.parent() != vis) return false;
-				if (!CheckParent(child)) return false;
+				auto current = pending.back();
+				pending.pop_back();
+
+				for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child)
+				{
+					if (child.parent() != current) return false;
+					pending.push_back(child);
+				}
 			}
 
 			return true;
@@ -651,10 +806,65 @@ namespace Chtholly
 
 		static void FixParent(Modifier modi)
 		{
-			for (auto child = modi.childrenBegin(); child != modi.childrenEnd(); ++child)
+			std::vector<Modifier> pending{ modi };
+
+			while (!pending.empty())
+			{
+				auto current = pending.back();
+				pending.pop_back();
+
+				for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child)
+				{
+					child.setParent(current);
+					if (!child.childrenEmpty()) pending.push_back(child);
+				}
+			}
+		}
+
+		// Merkle hash of the subtree under root, that is StructuralHash of it with 0 stored as 1 at any node.
+		// The hashes of the whole subtree are cached in its nodes until it is changed,
+		// so that Equals can tell most unequal subtrees apart at once and hashing again is O(1).
+		// It writes the cache: it must not run while other threads use the tree.
+		static std::size_t Hash(const Observer& root)
+		{
+			struct Frame
+			{
+				const Node* node;
+				typename Node::ConstIterator child;
+				std::size_t hash;
+			};
+
+			auto open = [](const Node* node) { return Frame{ node, node->children.begin(), std::hash<ValueType>{}(node->value) }; };
+
+			if ((*root).hash != 0) return (*root).hash;
+			std::vector<Frame> pending{ open(&*root) };
+
+			while (true)
 			{
-				child.setParent(modi);
-				FixParent(child);
+				auto& top = pending.back();
+
+				if (top.child != top.node->children.end())
+				{
+					const auto child = &*top.child++;
+					if (child->hash != 0)
+					{
+						top.hash = HashCombine(top.hash, child->hash);
+					}
+					else
+					{
+						pending.push_back(open(child));
+					}
+					continue;
+				}
+
+				auto hash = HashCombine(top.hash, top.node->children.size());
+				if (hash == 0) hash = 1;
+
+				top.node->hash = hash;
+				pending.pop_back();
+
+				if (pending.empty()) return hash;
+				pending.back().hash = HashCombine(pending.back().hash, hash);
 			}
 		}
 
@@ -663,11 +873,76 @@ namespace Chtholly
 			return *lhs == *rhs;
 		}
 
+		// Shape and memory of a tree, the hidden root excluded
+		struct Stats
+		{
+			Size nodeCount = 0;
+			Size maxDepth = 0;
+
+			// fanOut[n] is the number of nodes with n children
+			std::vector<Size> fanOut;
+
+			// nodes with a single child, which a flatter representation could collapse
+			Size singleChildCount = 0;
+
+			// bytes of the node allocations: value, links and the list hooks of every node
+			Size nodeBytes = 0;
+
+			double singleChildShare() const
+			{
+				return nodeCount == 0 ? 0 : double(singleChildCount) / nodeCount;
+			}
+		};
+
+		// bytes of one node allocation of a std::list
+		inline static constexpr Size nodeAllocationSize = sizeof(Node) + 2 * sizeof(void*);
+
+		// Collect the stats of the tree under root without recursion, calling visit for every node
+		template <typename F>
+		static Stats CollectStats(const Observer& root, F&& visit)
+		{
+			Stats stats;
+			std::vector<std::pair<Observer, Size>> pending{ { root, 1 } };
+
+			while (!pending.empty())
+			{
+				auto [current, depth] = pending.back();
+				pending.pop_back();
+
+				visit(current.value());
+
+				const auto size = current.childrenSize();
+				++stats.nodeCount;
+				stats.maxDepth = std::max(stats.maxDepth, depth);
+				if (stats.fanOut.size() <= size) stats.fanOut.resize(size + 1);
+				++stats.fanOut[size];
+				if (size == 1) ++stats.singleChildCount;
+
+				for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child)
+				{
+					pending.emplace_back(child, depth + 1);
+				}
+			}
+
+			stats.nodeBytes = stats.nodeCount * nodeAllocationSize;
+			return stats;
+		}
+
+		Stats stats() const
+		{
+			return CollectStats(observer(), [](const ValueType&) {});
+		}
+
 		bool operator==(const BasicTree& other) const
 		{
 			return Equals(observer(), other.observer());
 		}
 
+		std::size_t hash() const
+		{
+			return Hash(observer());
+		}
+
 		bool checkParent() const
 		{
 			return CheckParent(observer());
@@ -681,6 +956,136 @@ namespace Chtholly
 		~BasicTree() = default;
 	};
 
+	// Interned name of a parse unit.
+	// Copying and comparing a name is an integer operation, its spelling lives in a process-wide table.
+	class ParseUnitName
+	{
+	public:
+
+		using Id = std::uint32_t;
+		using String = std::string;
+
+		// Names of the Chtholly grammar, interned first so that they get small and stable ids
+		inline static constexpr std::string_view predefinedNames[] = {
+			"unused", "root",
+			"IntLiteral", "FloatLiteral", "StringLiteral", "Identifier",
+			"NullLiteral", "UndefinedLiteral", "TrueLiteral", "FalseLiteral",
+			"Separator", "BinaryOperator", "UnaryOperator",
+			"Expression", "ArrayList", "DictList", "UndefExpression",
+			"ConstraintExpression", "ConstraintExpressionAtPatternExpression", "PatternExpression",
+			"VarDefineExpression", "ConstDefineExpression", "LambdaExpression", "ConditionExpression",
+			"ReturnExpression", "BreakExpression", "ContinueExpression",
+			"WhileLoopExpression", "DoWhileLoopExpression", "FunctionExpression",
+			"PointExpression", "FoldExpression", "UnaryExpression",
+			"MultiplicativeExpression", "AdditiveExpression", "RelationalExpression", "EqualityExpression",
+			"LogicalAndExpression", "LogicalOrExpression", "AssignmentExpression", "PairExpression"
+		};
+
+		inline static constexpr Id predefinedSize = Id(std::size(predefinedNames));
+
+	private:
+
+		struct Table
+		{
+			std::mutex mutex;
+
+			// std::deque never moves its elements, so the views in ids stay valid
+			std::deque<String> names;
+			std::unordered_map<std::string_view, Id> ids;
+
+			Table()
+			{
+				for (auto name : predefinedNames) intern(name);
+			}
+
+			Id intern(std::string_view name)
+			{
+				if (auto found = ids.find(name); found != ids.end()) return found->second;
+
+				const auto id = Id(names.size());
+				ids.emplace(names.emplace_back(name), id);
+				return id;
+			}
+		};
+
+		static Table& GetTable()
+		{
+			static Table table;
+			return table;
+		}
+
+		Id _id;
+
+		constexpr ParseUnitName(Id id, std::in_place_t) : _id(id) {}
+
+	public:
+
+		static Id Intern(std::string_view name)
+		{
+			auto& table = GetTable();
+			std::lock_guard lock(table.mutex);
+			return table.intern(name);
+		}
+
+		static const String& Spelling(Id id)
+		{
+			auto& table = GetTable();
+			std::lock_guard lock(table.mutex);
+			return table.names.at(id);
+		}
+
+		// Number of names interned so far
+		static Id Size()
+		{
+			auto& table = GetTable();
+			std::lock_guard lock(table.mutex);
+			return Id(table.names.size());
+		}
+
+		ParseUnitName(std::string_view name) : _id(Intern(name)) {}
+		ParseUnitName(const String& name) : _id(Intern(name)) {}
+		ParseUnitName(const char* name) : _id(Intern(name)) {}
+
+		static constexpr ParseUnitName FromId(Id id)
+		{
+			return { id, std::in_place };
+		}
+
+		// Name of the grammar with a compile-time id, without touching the name table
+		static constexpr ParseUnitName Predefined(std::string_view name)
+		{
+			for (Id id = 0; id < predefinedSize; ++id)
+			{
+				if (predefinedNames[id] == name) return FromId(id);
+			}
+
+			throw std::invalid_argument("ParseUnitName::Predefined: unknown name");
+		}
+
+		constexpr Id id() const
+		{
+			return _id;
+		}
+
+		const String& str() const
+		{
+			return Spelling(_id);
+		}
+
+		constexpr bool operator==(const ParseUnitName& other) const
+		{
+			return _id == other._id;
+		}
+		constexpr bool operator!=(const ParseUnitName& other) const
+		{
+			return _id != other._id;
+		}
+		constexpr bool operator<(const ParseUnitName& other) const
+		{
+			return _id < other._id;
+		}
+	};
+
 	template <typename inStringView>
 	class BasicParseUnit
 	{
@@ -689,6 +1094,7 @@ namespace Chtholly
 
 		using StringView = inStringView;
 		using String = std::string;
+		using Name = ParseUnitName;
 		
 		enum class Type { token = 1, term };
 
@@ -696,11 +1102,11 @@ namespace Chtholly
 
 
 		Type type;
-		String name;
+		Name name;
 		StringView value;
 
 		template <typename ...T, std::enable_if_t<std::is_constructible_v<StringView, T&&...>, int> = 0>
-		BasicParseUnit(Type inType, String inName, T&& ... inValue) : type(inType), name(std::move(inName)), value(inValue...) {}
+		BasicParseUnit(Type inType, Name inName, T&& ... inValue) : type(inType), name(inName), value(inValue...) {}
 
 		BasicParseUnit(const BasicParseUnit& src) : type(src.type), name(src.name), value(src.value) {}
 
@@ -728,14 +1134,15 @@ namespace Chtholly
 	template<typename ValueType>
 	BasicParseUnit<ValueType> UnusedConstruct(std::in_place_type_t<BasicParseUnit<ValueType>>)
 	{
-		return { BasicParseUnit<ValueType>::Type::term, "unused" };
+		constexpr auto unused = ParseUnitName::Predefined("unused");
+		return { BasicParseUnit<ValueType>::Type::term, unused };
 	}
 
 
 	using ParseUnit = BasicParseUnit<std::string_view>;
 
-	template <typename StringView>
-	class BasicParseTree : public BasicTree<BasicParseUnit<StringView>>
+	template <typename StringView, typename Allocator = std::allocator<BasicParseUnit<StringView>>>
+	class BasicParseTree : public BasicTree<BasicParseUnit<StringView>, Allocator>
 	{
 	public:
 
@@ -743,7 +1150,7 @@ namespace Chtholly
 
 	private:
 
-		using Super	= BasicTree<Unit>;
+		using Super	= BasicTree<Unit, Allocator>;
 
 		using typename Super::Node;
 
@@ -755,10 +1162,12 @@ namespace Chtholly
 
 		using typename Super::NodeWrapper;
 
-		using UnitName	= typename Unit::String;
+		using UnitName	= typename Unit::Name;
 		using UnitValue	= typename Unit::StringView;
 		using UnitType	= typename Unit::Type;
 
+		using typename Super::Size;
+
 		template <typename... Nodes>
 		BasicParseTree(const UnitName& rootName, Nodes&& ...nodes) 
 			: Super(typename Node::Container{ Node{std::forward<Nodes>(nodes)}... }, UnitType::term, rootName)
@@ -766,13 +1175,56 @@ namespace Chtholly
 			static_assert(std::conjunction_v<std::is_same<std::remove_reference_t<Nodes>, NodeWrapper>...>, "BasicParseTree::BasicParseTree: invalid arguments type");
 		}
 
-		template <typename... Nodes, std::enable_if_t<std::conjunction_v<std::negation<std::is_constructible<UnitName, Nodes>>...>,int> = 0>
+		inline static constexpr UnitName rootName = ParseUnitName::Predefined("root");
+
+		template <typename... Nodes, std::enable_if_t<std::conjunction_v<
+			std::negation<std::is_constructible<UnitName, Nodes>>...,
+			std::negation<std::is_same<std::decay_t<Nodes>, std::allocator_arg_t>>...
+		>,int> = 0>
 		BasicParseTree(Nodes&& ...nodes)
-			: BasicParseTree("root", std::forward<Nodes>(nodes)...)
+			: BasicParseTree(rootName, std::forward<Nodes>(nodes)...)
 		{
 			static_assert(std::conjunction_v<std::is_same<std::remove_reference_t<Nodes>, NodeWrapper>...>, "BasicParseTree::BasicParseTree: invalid arguments type");
 		}
 
+		// An empty tree whose nodes are allocated through alloc
+		BasicParseTree(std::allocator_arg_t, const Allocator& alloc)
+			: Super(std::allocator_arg, alloc, UnitType::term, rootName) {}
+
+		struct Stats : Super::Stats
+		{
+			Size tokenCount = 0;
+			Size termCount = 0;
+
+			// number of nodes by name
+			std::map<std::string, Size> nameCount;
+
+			// bytes of the names: the interned ids in the nodes and the spellings of the distinct names
+			Size nameBytes = 0;
+		};
+
+		Stats stats() const
+		{
+			std::unordered_map<typename UnitName::Id, Size> countById;
+
+			Stats stats;
+			static_cast<typename Super::Stats&>(stats) = Super::CollectStats(this->observer(), [&](const Unit& unit)
+			{
+				++(unit.type == UnitType::token ? stats.tokenCount : stats.termCount);
+				++countById[unit.name.id()];
+			});
+
+			stats.nameBytes = stats.nodeCount * sizeof(UnitName);
+			for (auto [id, count] : countById)
+			{
+				const auto& spelling = UnitName::Spelling(id);
+				stats.nameCount.emplace(spelling, count);
+				stats.nameBytes += spelling.size();
+			}
+
+			return stats;
+		}
+
 		static NodeWrapper Token(const UnitName& name, const UnitValue& value)
 		{
 			return NodeWrapper{ Node {UnitType::token, name, value} };
@@ -790,6 +1242,212 @@ namespace Chtholly
 
 	using ParseTree = BasicParseTree<std::string_view>;
 
+	using ArenaParseTree = BasicParseTree<std::string_view, ArenaAllocator<ParseUnit>>;
+
+	enum class TreeFormat { sexpr = 1, json, indented };
+
+	template <typename Char, typename Traits>
+	void TreeWriterAppend(std::basic_ostream<Char, Traits>& out, const Char* data, std::size_t size)
+	{
+		out.write(data, size);
+	}
+
+	template <typename Char, typename Traits, typename Alloc>
+	void TreeWriterAppend(std::basic_string<Char, Traits, Alloc>& out, const Char* data, std::size_t size)
+	{
+		out.append(data, size);
+	}
+
+	// Writes a tree of parse units in a single pass without recursion,
+	// into an output stream or a string used as a growable buffer
+	template <typename Out>
+	class BasicTreeWriter
+	{
+	public:
+
+		using Char = typename Out::traits_type::char_type;
+		using StringView = std::basic_string_view<Char>;
+
+	private:
+
+		Out& out;
+		TreeFormat format;
+
+		void put(Char c)
+		{
+			TreeWriterAppend(out, &c, 1);
+		}
+
+		void put(StringView str)
+		{
+			TreeWriterAppend(out, str.data(), str.size());
+		}
+
+		// names and punctuation are narrow strings
+		void putNarrow(std::string_view str)
+		{
+			if constexpr (std::is_same_v<Char, char>)
+			{
+				put(str);
+			}
+			else
+			{
+				for (auto c : str) put(Char(c));
+			}
+		}
+
+		void putEscaped(StringView str)
+		{
+			constexpr char hex[] = "0123456789abcdef";
+
+			std::size_t begin = 0;
+			for (std::size_t i = 0; i < str.size(); ++i)
+			{
+				const auto c = str[i];
+				if (c != Char('"') && c != Char('\\') && static_cast<std::make_unsigned_t<Char>>(c) >= 0x20) continue;
+
+				put(str.substr(begin, i - begin));
+				begin = i + 1;
+
+				if (c == Char('"') || c == Char('\\'))
+				{
+					put(Char('\\'));
+					put(c);
+				}
+				else
+				{
+					const char escaped[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+					putNarrow({ escaped, sizeof(escaped) });
+				}
+			}
+			put(str.substr(begin));
+		}
+
+		template <typename Observer>
+		void enter(const Observer& node, std::size_t depth)
+		{
+			const auto& unit = node.value();
+			const auto isTerm = unit.type == std::decay_t<decltype(unit)>::Type::term;
+
+			switch (format)
+			{
+			case TreeFormat::sexpr:
+				if (isTerm)
+				{
+					put(Char('('));
+					putNarrow(unit.name.str());
+					put(Char(' '));
+				}
+				else
+				{
+					putNarrow(unit.name.str());
+					put(Char('['));
+					put(StringView(unit.value.data(), unit.value.size()));
+					putNarrow("] ");
+				}
+				break;
+
+			case TreeFormat::json:
+				putNarrow(isTerm ? R"({"type":"term","name":")" : R"({"type":"token","name":")");
+				putNarrow(unit.name.str());
+				put(Char('"'));
+				if (!isTerm)
+				{
+					putNarrow(R"(,"value":")");
+					putEscaped(StringView(unit.value.data(), unit.value.size()));
+					put(Char('"'));
+				}
+				if (isTerm || !node.childrenEmpty()) putNarrow(R"(,"children":[)");
+				break;
+
+			case TreeFormat::indented:
+				for (std::size_t i = 0; i < depth; ++i) putNarrow("  ");
+				putNarrow(unit.name.str());
+				if (!isTerm)
+				{
+					putNarrow(" [");
+					put(StringView(unit.value.data(), unit.value.size()));
+					put(Char(']'));
+				}
+				put(Char('\n'));
+				break;
+			}
+		}
+
+		template <typename Observer>
+		void leave(const Observer& node)
+		{
+			const auto& unit = node.value();
+			const auto isTerm = unit.type == std::decay_t<decltype(unit)>::Type::term;
+
+			switch (format)
+			{
+			case TreeFormat::sexpr:
+				if (isTerm) put(Char(')'));
+				break;
+
+			case TreeFormat::json:
+				if (isTerm || !node.childrenEmpty()) put(Char(']'));
+				put(Char('}'));
+				break;
+
+			case TreeFormat::indented:
+				break;
+			}
+		}
+
+	public:
+
+		BasicTreeWriter(Out& inOut, TreeFormat inFormat = TreeFormat::sexpr) : out(inOut), format(inFormat) {}
+
+		template <typename Observer>
+		void write(const Observer& root)
+		{
+			struct Frame
+			{
+				Observer node;
+				Observer child;
+			};
+
+			enter(root, 0);
+			std::vector<Frame> pending{ { root, root.childrenBegin() } };
+
+			while (!pending.empty())
+			{
+				auto& top = pending.back();
+
+				if (top.child != top.node.childrenEnd())
+				{
+					auto child = top.child;
+					if (format == TreeFormat::json && child != top.node.childrenBegin()) put(Char(','));
+					++top.child;
+
+					enter(child, pending.size());
+					pending.push_back({ child, child.childrenBegin() });
+				}
+				else
+				{
+					leave(top.node);
+					pending.pop_back();
+				}
+			}
+		}
+	};
+
+	template <typename Out, typename Observer>
+	Out& WriteTree(Out& out, const Observer& root, TreeFormat format = TreeFormat::sexpr)
+	{
+		BasicTreeWriter<Out>(out, format).write(root);
+		return out;
+	}
+
+	template <typename Char = char, typename Observer>
+	std::basic_string<Char> TreeToString(const Observer& root, TreeFormat format = TreeFormat::sexpr)
+	{
+		std::basic_string<Char> out;
+		return WriteTree(out, root, format);
+	}
+
 	inline auto Token = ParseTree::Token;
 
 	template <typename ...Args>
@@ -798,3 +1456,26 @@ namespace Chtholly
 		return ParseTree::Term(std::forward<Args>(args)...);
 	}
 }
+
+namespace std
+{
+	template <>
+	struct hash<Chtholly::ParseUnitName>
+	{
+		std::size_t operator()(const Chtholly::ParseUnitName& name) const noexcept
+		{
+			return std::hash<Chtholly::ParseUnitName::Id>{}(name.id());
+		}
+	};
+
+	template <typename StringView>
+	struct hash<Chtholly::BasicParseUnit<StringView>>
+	{
+		std::size_t operator()(const Chtholly::BasicParseUnit<StringView>& unit) const noexcept
+		{
+			auto seed = std::hash<Chtholly::ParseUnitName>{}(unit.name);
+			seed ^= std::hash<StringView>{}(unit.value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			return seed * 2 + (unit.type == Chtholly::BasicParseUnit<StringView>::Type::term);
+		}
+	};
+}
@@ -0,0 +1,688 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "instruction.hpp"
+#include "controlflow.hpp"
+
+namespace Chtholly
+{
+	enum class RegisterOpcode : std::uint8_t
+	{
+		Move,	// result = operands[0]
+		Literal,	// result = immediates[0], or null / undef / a constant as told by source
+		Use,	// result = the object named immediates[0]
+		Call,	// result = operands[0](operands[1...])
+		Declare,	// result = a pattern named immediates[0], constrained by operands[0] if any
+		Define,	// result = the objects defined by the patterns and init values in operands
+		Attach,	// result = operands[0] attached to immediates
+		Push,	// list push of operands[0]
+		Pop,	// result = list pop
+		Closure,	// result = the function at index immediates[0] of the lowering
+		Jump,	// to the instruction at immediates[0]
+		JumpIf,	// to immediates[0] if operands[0], else to the next instruction
+		JumpIfElse,	// to immediates[0] if operands[0], else to immediates[1]
+		Return	// leave the function with the values of operands
+	};
+
+	inline constexpr std::string_view registerOpcodeNames[] = {
+		"Register::Move", "Register::Literal", "Register::Use", "Register::Call", "Register::Declare",
+		"Register::Define", "Register::Attach", "Register::Push", "Register::Pop", "Register::Closure",
+		"Register::Jump", "Register::JumpIf", "Register::JumpIfElse", "Register::Return"
+	};
+
+	constexpr std::string_view RegisterOpcodeName(RegisterOpcode code)
+	{
+		const auto index = static_cast<std::size_t>(code);
+		return index < std::size(registerOpcodeNames) ? registerOpcodeNames[index] : std::string_view{};
+	}
+
+	using Register = std::uint16_t;
+
+	inline constexpr Register noRegister = std::numeric_limits<Register>::max();
+
+	// registers from here on name the spill slots of a function, kept in memory rather than in its frame
+	inline constexpr Register firstSpillSlot = 0x8000;
+
+	constexpr bool IsSpillSlot(Register reg)
+	{
+		return reg >= firstSpillSlot && reg != noRegister;
+	}
+
+	// Three-address instruction: registers are slots of the frame of the function it belongs to
+	template <typename V>
+	struct BasicRegisterInstruction
+	{
+		using Value = V;
+
+		RegisterOpcode opcode;
+		OpcodeId source;	// the stack instruction it comes from, telling apart kinds of literals, declarations and definitions
+		Register result = noRegister;
+		std::vector<Register> operands;
+		std::vector<Value> immediates;
+
+		bool operator==(const BasicRegisterInstruction& other) const
+		{
+			return opcode == other.opcode && source == other.source && result == other.result &&
+				operands == other.operands && immediates == other.immediates;
+		}
+
+		bool operator!=(const BasicRegisterInstruction& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	// Lowering of a stack instruction sequence to register code, one instruction per value-producing
+	// stack instruction: the frame brackets, Block::End of a non-empty block and Control::Mark disappear.
+	// Each function (the sequence itself first, then every Function::Begin body) is lowered through its
+	// ControlFlowGraph: SSA values become virtual registers, phis become moves on the incoming edges
+	// (through a stub appended to the code for a branch to a block with phis), and a linear scan
+	// over the live intervals packs the virtual registers into the fewest frame slots.
+	// When more values are live than the frame holds, the one living longest is spilled: its register
+	// names a spill slot in memory (see IsSpillSlot) for its whole life, and is read and written in place.
+	// The values left on the stack at the end of a function are the operands of a Register::Return ending it.
+	// An interpreter reads the operands of an instruction before writing its result,
+	// so the result may share the slot of an operand used for the last time.
+	template <typename V>
+	class BasicRegisterLowering
+	{
+	public:
+
+		using Value = V;
+		using Instruction = BasicInstruction<Value>;
+		using Sequence = std::vector<Instruction>;
+		using RegisterInstruction = BasicRegisterInstruction<Value>;
+		using Graph = BasicControlFlowGraph<Value>;
+
+		using Int = typename Value::Int;
+
+		using Size = std::size_t;
+
+		struct Options
+		{
+			Size frameSize = 256;	// registers available to a function, values beyond are spilled to memory
+		};
+
+		struct Function
+		{
+			std::vector<RegisterInstruction> code;
+			Size frameSize = 0;	// registers used
+			Size spillSize = 0;	// spill slots used, from firstSpillSlot on
+			Size stackSize = 0;	// stack instructions lowered, nested function bodies excluded
+		};
+
+		struct Result
+		{
+			std::vector<Function> functions;	// the sequence itself first
+
+			Size instructionCount() const
+			{
+				Size count = 0;
+				for (const auto& function : functions) count += function.code.size();
+				return count;
+			}
+		};
+
+	private:
+
+		using Index = typename Graph::Index;
+		using VirtualRegister = std::uint32_t;
+
+		struct Fixup
+		{
+			Size instruction;
+			Size immediate;
+			Size label;
+		};
+
+		static bool IsJump(RegisterOpcode opcode)
+		{
+			return opcode == RegisterOpcode::Jump || opcode == RegisterOpcode::JumpIf || opcode == RegisterOpcode::JumpIfElse;
+		}
+
+		struct Move
+		{
+			VirtualRegister to;
+			VirtualRegister from;
+		};
+
+		struct Lowerer
+		{
+			const Sequence& seq;
+			const BlockIndex& brackets;
+			const Options& options;
+			Result& result;
+
+			Lowerer(const Sequence& seq, const BlockIndex& brackets, const Options& options, Result& result)
+				: seq(seq), brackets(brackets), options(options), result(result) {}
+
+			// the code with virtual registers, before allocation
+			std::vector<RegisterInstruction> code;
+			std::vector<VirtualRegister> results;
+			std::vector<std::vector<VirtualRegister>> operands;
+
+			VirtualRegister registerCount = 0;
+
+			std::vector<Size> labels;
+			std::vector<Fixup> fixups;
+
+			void emit(RegisterOpcode opcode, OpcodeId source, VirtualRegister to, std::vector<VirtualRegister> from, std::vector<Value> immediates = {})
+			{
+				code.push_back({ opcode, source, noRegister, {}, std::move(immediates) });
+				results.push_back(to);
+				operands.push_back(std::move(from));
+			}
+
+			void emitJump(RegisterOpcode opcode, std::vector<VirtualRegister> condition, std::vector<Size> targets)
+			{
+				for (Size i = 0; i < targets.size(); ++i) fixups.push_back({ code.size(), i, targets[i] });
+				emit(opcode, OpcodeId::None, npos, std::move(condition), std::vector<Value>(targets.size(), Int(0)));
+			}
+
+			// a parallel copy as a sequence of moves, breaking cycles through a new register
+			void emitMoves(std::vector<Move> moves)
+			{
+				moves.erase(std::remove_if(moves.begin(), moves.end(), [](const Move& move) { return move.to == move.from; }), moves.end());
+
+				while (!moves.empty())
+				{
+					auto ready = std::find_if(moves.begin(), moves.end(), [&](const Move& move)
+					{
+						return std::none_of(moves.begin(), moves.end(), [&](const Move& other) { return other.from == move.to; });
+					});
+
+					if (ready == moves.end())
+					{
+						const auto temporary = registerCount++, saved = moves.front().from;
+						emit(RegisterOpcode::Move, OpcodeId::None, temporary, { saved });
+						for (auto& move : moves)
+						{
+							if (move.from == saved) move.from = temporary;
+						}
+						continue;
+					}
+
+					emit(RegisterOpcode::Move, OpcodeId::None, ready->to, { ready->from });
+					moves.erase(ready);
+				}
+			}
+
+			static std::vector<Move> EdgeMoves(const Graph& graph, Index from, Index to)
+			{
+				const auto& block = graph.blocks()[to];
+				const auto k = Size(std::find(block.predecessors.begin(), block.predecessors.end(), from) - block.predecessors.begin());
+
+				std::vector<Move> moves;
+				for (auto phi : block.phis) moves.push_back({ phi, graph.values()[phi].operands[k] });
+				return moves;
+			}
+
+			inline static constexpr VirtualRegister npos = std::numeric_limits<VirtualRegister>::max();
+
+			void lowerInstruction(const Graph& graph, Size i)
+			{
+				const auto& instruction = seq[i];
+				const auto& operation = graph.operation(i);
+				const auto source = instruction.opcode();
+
+				std::vector<VirtualRegister> from(operation.operands.begin(), operation.operands.end());
+				const auto to = operation.result == Graph::npos ? npos : VirtualRegister(operation.result);
+
+				switch (source)
+				{
+				case OpcodeId::LiteralInt: case OpcodeId::LiteralFloat: case OpcodeId::LiteralString: case OpcodeId::LiteralBool:
+				case OpcodeId::LiteralNull: case OpcodeId::LiteralUndef: case OpcodeId::LiteralConstant:
+					emit(RegisterOpcode::Literal, source, to, {}, instruction.oprands());
+					break;
+				case OpcodeId::ObjectUse:
+					emit(RegisterOpcode::Use, source, to, {}, instruction.oprands());
+					break;
+				case OpcodeId::FunctionCall:
+					emit(RegisterOpcode::Call, source, to, std::move(from));
+					break;
+				case OpcodeId::ObjectVar: case OpcodeId::ObjectVarWithConstraint: case OpcodeId::ObjectVarPack: case OpcodeId::ObjectVarPackWithConstraint:
+				case OpcodeId::ObjectConst: case OpcodeId::ObjectConstWithConstraint: case OpcodeId::ObjectConstPack: case OpcodeId::ObjectConstPackWithConstraint:
+					emit(RegisterOpcode::Declare, source, to, std::move(from), instruction.oprands());
+					break;
+				case OpcodeId::ObjectEnd: case OpcodeId::ObjectEndWithInit:
+					emit(RegisterOpcode::Define, source, to, std::move(from));
+					break;
+				case OpcodeId::ObjectAttachTo:
+					emit(RegisterOpcode::Attach, source, to, std::move(from), instruction.oprands());
+					break;
+				case OpcodeId::ListPush:
+					emit(RegisterOpcode::Push, source, npos, std::move(from));
+					break;
+				case OpcodeId::ListPop:
+					emit(RegisterOpcode::Pop, source, to, {});
+					break;
+				case OpcodeId::BlockEnd:
+					// an empty block leaves undef, any other one its values as they are
+					if (operation.result != Graph::npos)
+					{
+						emit(RegisterOpcode::Literal, OpcodeId::LiteralUndef, to, {});
+					}
+					break;
+				case OpcodeId::FunctionBegin:
+				{
+					const auto end = brackets.partner(i);
+					emit(RegisterOpcode::Closure, source, to, {}, { Int(Lower(seq, brackets, i + 1, end, options, result)) });
+					break;
+				}
+				default:
+					// frame brackets, marks and jumps, the last ones lowered with the edges of their block
+					break;
+				}
+			}
+
+			Function lower(Size begin, Size end)
+			{
+				const auto graph = Graph::Build(seq, brackets, begin, end);
+				const auto& blocks = graph.blocks();
+
+				registerCount = VirtualRegister(graph.values().size());
+				labels.assign(blocks.size(), 0);
+
+				// laid out in the order of the sequence, so that a fall-through edge leads to the next block
+				std::vector<Index> layout;
+				for (Index b = 0; b < blocks.size(); ++b)
+				{
+					if (graph.reachable(b)) layout.push_back(b);
+				}
+
+				struct Stub
+				{
+					Size label;
+					Index from;
+					Index to;
+				};
+				std::vector<Stub> stubs;
+
+				// the label of an edge taken by a jump, a stub if there are moves on it
+				auto edge = [&](Index from, Index to) -> Size
+				{
+					if (blocks[to].phis.empty()) return to;
+
+					labels.push_back(0);
+					stubs.push_back({ labels.size() - 1, from, to });
+					return labels.size() - 1;
+				};
+
+				for (Size l = 0; l < layout.size(); ++l)
+				{
+					const auto b = layout[l];
+					const auto& block = blocks[b];
+					const auto next = l + 1 < layout.size() ? layout[l + 1] : Graph::npos;
+
+					labels[b] = code.size();
+
+					for (Index i = block.begin; i < block.end; ++i)
+					{
+						lowerInstruction(graph, i);
+						if (seq[i].opcode() == OpcodeId::FunctionBegin) i = brackets.partner(i);
+					}
+
+					const auto last = block.begin == block.end ? OpcodeId::None : seq[block.end - 1].opcode();
+					const auto& successors = block.successors;
+
+					auto fallThrough = [&](Index to)
+					{
+						emitMoves(EdgeMoves(graph, b, to));
+						if (to != next) emitJump(RegisterOpcode::Jump, {}, { to });
+					};
+
+					switch (last)
+					{
+					case OpcodeId::ControlJumpIf: case OpcodeId::ControlJumpIfTo:
+						emitJump(RegisterOpcode::JumpIf, { VirtualRegister(graph.operation(block.end - 1).operands[0]) }, { edge(b, successors[0]) });
+						fallThrough(successors[1]);
+						break;
+					case OpcodeId::ControlJumpIfElse: case OpcodeId::ControlJumpIfElseTo:
+					{
+						const auto whenTrue = edge(b, successors[0]);
+						emitJump(RegisterOpcode::JumpIfElse, { VirtualRegister(graph.operation(block.end - 1).operands[0]) }, { whenTrue, edge(b, successors[1]) });
+						break;
+					}
+					default:
+						if (!successors.empty()) fallThrough(successors[0]);
+					}
+				}
+
+				// the exit block is the last one of the layout if it is reachable
+				if (!layout.empty() && blocks[layout.back()].end == end && blocks[layout.back()].successors.empty())
+				{
+					emit(RegisterOpcode::Return, OpcodeId::None, npos, std::vector<VirtualRegister>(graph.results().begin(), graph.results().end()));
+				}
+
+				for (const auto& stub : stubs)
+				{
+					labels[stub.label] = code.size();
+					emitMoves(EdgeMoves(graph, stub.from, stub.to));
+					emitJump(RegisterOpcode::Jump, {}, { stub.to });
+				}
+
+				for (const auto& fixup : fixups)
+				{
+					code[fixup.instruction].immediates[fixup.immediate] = Int(labels[fixup.label]);
+				}
+
+				Function function;
+				allocate(function);
+				function.stackSize = 0;
+				for (Size i = begin; i < end; ++i)
+				{
+					if (seq[i].opcode() == OpcodeId::FunctionBegin) i = brackets.partner(i);
+					++function.stackSize;
+				}
+
+				// moves between registers sharing a slot are left out, the jumps going to what follows them
+				std::vector<Size> kept(code.size() + 1, 0);
+				for (Size p = 0; p < code.size(); ++p)
+				{
+					const bool redundant = code[p].opcode == RegisterOpcode::Move && code[p].result == code[p].operands[0];
+					kept[p + 1] = kept[p] + (redundant ? 0 : 1);
+				}
+
+				for (Size p = 0; p < code.size(); ++p)
+				{
+					if (kept[p + 1] == kept[p]) continue;
+
+					if (IsJump(code[p].opcode))
+					{
+						for (auto& target : code[p].immediates) target = Int(kept[Size(std::get<Int>(target))]);
+					}
+					function.code.push_back(std::move(code[p]));
+				}
+
+				return function;
+			}
+
+			struct Interval
+			{
+				Size start;
+				Size end;
+				VirtualRegister reg;
+			};
+
+			// linear scan over the live intervals of the virtual registers, setting the frame and spill sizes
+			void allocate(Function& function)
+			{
+				std::vector<Size> starts(registerCount, std::numeric_limits<Size>::max()), ends(registerCount, 0);
+
+				for (Size p = 0; p < code.size(); ++p)
+				{
+					auto touch = [&](VirtualRegister reg)
+					{
+						starts[reg] = std::min(starts[reg], p);
+						ends[reg] = std::max(ends[reg], p);
+					};
+
+					if (results[p] != npos) touch(results[p]);
+					for (auto reg : operands[p]) touch(reg);
+				}
+
+				// extend the intervals over the blocks of the lowered code through which the registers are live
+				auto isJump = [&](Size p)
+				{
+					return IsJump(code[p].opcode);
+				};
+				auto closes = [&](Size p)
+				{
+					return isJump(p) || code[p].opcode == RegisterOpcode::Return;
+				};
+
+				std::vector<bool> leaders(code.size() + 1, false);
+				leaders[0] = true;
+				for (Size p = 0; p < code.size(); ++p)
+				{
+					if (!closes(p)) continue;
+
+					leaders[p + 1] = true;
+					if (!isJump(p)) continue;
+					for (const auto& target : code[p].immediates) leaders[Size(std::get<Int>(target))] = true;
+				}
+
+				std::vector<Size> blockStarts, blockAt(code.size() + 1, npos);
+				for (Size p = 0; p < code.size(); ++p)
+				{
+					if (!leaders[p]) continue;
+
+					blockAt[p] = blockStarts.size();
+					blockStarts.push_back(p);
+				}
+				blockStarts.push_back(code.size());
+
+				// the sets of live registers are sorted vectors, most registers living in a single block
+				using Set = std::vector<VirtualRegister>;
+
+				const auto blockCount = blockStarts.size() - 1;
+				std::vector<std::vector<Size>> successors(blockCount);
+				std::vector<Set> gen(blockCount), kill(blockCount), in(blockCount), out(blockCount);
+
+				// the last block in which a register was defined or used before its definition
+				std::vector<Size> killedIn(registerCount, npos), usedIn(registerCount, npos);
+
+				for (Size b = 0; b < blockCount; ++b)
+				{
+					const auto last = blockStarts[b + 1] - 1;
+					if (isJump(last))
+					{
+						for (const auto& target : code[last].immediates)
+						{
+							const auto t = Size(std::get<Int>(target));
+							if (t < code.size()) successors[b].push_back(blockAt[t]);
+						}
+					}
+					if ((!closes(last) || code[last].opcode == RegisterOpcode::JumpIf) && b + 1 < blockCount) successors[b].push_back(b + 1);
+
+					for (Size p = blockStarts[b]; p <= last; ++p)
+					{
+						for (auto reg : operands[p])
+						{
+							if (killedIn[reg] != b && usedIn[reg] != b)
+							{
+								usedIn[reg] = b;
+								gen[b].push_back(reg);
+							}
+						}
+						if (results[p] != npos && killedIn[results[p]] != b)
+						{
+							killedIn[results[p]] = b;
+							kill[b].push_back(results[p]);
+						}
+					}
+
+					std::sort(gen[b].begin(), gen[b].end());
+					std::sort(kill[b].begin(), kill[b].end());
+					in[b] = gen[b];
+				}
+
+				// the sets only grow, so a set changes if and only if its size does
+				Set merged, live;
+				for (bool changed = true; changed;)
+				{
+					changed = false;
+					for (Size b = blockCount; b-- > 0;)
+					{
+						for (auto s : successors[b])
+						{
+							merged.clear();
+							std::set_union(out[b].begin(), out[b].end(), in[s].begin(), in[s].end(), std::back_inserter(merged));
+							if (merged.size() != out[b].size())
+							{
+								out[b].swap(merged);
+								changed = true;
+							}
+						}
+
+						live.clear();
+						std::set_difference(out[b].begin(), out[b].end(), kill[b].begin(), kill[b].end(), std::back_inserter(live));
+						merged.clear();
+						std::set_union(gen[b].begin(), gen[b].end(), live.begin(), live.end(), std::back_inserter(merged));
+						if (merged.size() != in[b].size())
+						{
+							in[b].swap(merged);
+							changed = true;
+						}
+					}
+				}
+
+				for (Size b = 0; b < blockCount; ++b)
+				{
+					for (auto reg : in[b]) starts[reg] = std::min(starts[reg], blockStarts[b]);
+					for (auto reg : out[b]) ends[reg] = std::max(ends[reg], blockStarts[b + 1] - 1);
+				}
+
+				std::vector<Interval> intervals;
+				for (VirtualRegister reg = 0; reg < registerCount; ++reg)
+				{
+					if (starts[reg] <= ends[reg]) intervals.push_back({ starts[reg], ends[reg], reg });
+				}
+				std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) { return a.start < b.start; });
+
+				const auto frameLimit = std::min(options.frameSize, Size(firstSpillSlot));
+				const auto spillLimit = Size(noRegister - firstSpillSlot);
+
+				std::vector<Register> slots(registerCount, noRegister);
+				std::priority_queue<Register, std::vector<Register>, std::greater<>> free, freeSpills;
+				std::set<std::pair<Size, VirtualRegister>> active, activeSpills;	// by end
+
+				// a register ending where this one starts is read before this one is written
+				auto expire = [&](std::set<std::pair<Size, VirtualRegister>>& live, auto& pool, Size start)
+				{
+					while (!live.empty() && live.begin()->first <= start)
+					{
+						pool.push(slots[live.begin()->second]);
+						live.erase(live.begin());
+					}
+				};
+
+				auto spill = [&](VirtualRegister reg, Size end)
+				{
+					Register slot;
+					if (!freeSpills.empty())
+					{
+						slot = freeSpills.top();
+						freeSpills.pop();
+					}
+					else
+					{
+						if (function.spillSize >= spillLimit)
+						{
+							throw std::length_error("RegisterLowering: more than " + std::to_string(spillLimit) + " values spilled at once");
+						}
+						slot = Register(firstSpillSlot + function.spillSize++);
+					}
+
+					slots[reg] = slot;
+					activeSpills.insert({ end, reg });
+				};
+
+				for (const auto& interval : intervals)
+				{
+					expire(active, free, interval.start);
+					expire(activeSpills, freeSpills, interval.start);
+
+					if (!free.empty())
+					{
+						slots[interval.reg] = free.top();
+						free.pop();
+					}
+					else if (function.frameSize < frameLimit)
+					{
+						slots[interval.reg] = Register(function.frameSize++);
+					}
+					else
+					{
+						// the frame is full: the value living longest goes to memory
+						if (active.empty() || std::prev(active.end())->first <= interval.end)
+						{
+							spill(interval.reg, interval.end);
+							continue;
+						}
+
+						const auto [end, reg] = *std::prev(active.end());
+						slots[interval.reg] = slots[reg];
+						active.erase(std::prev(active.end()));
+						spill(reg, end);
+					}
+
+					active.insert({ interval.end, interval.reg });
+				}
+
+				for (Size p = 0; p < code.size(); ++p)
+				{
+					if (results[p] != npos) code[p].result = slots[results[p]];
+					for (auto reg : operands[p]) code[p].operands.push_back(slots[reg]);
+				}
+			}
+		};
+
+		// lower the function of the instructions in [begin, end), returning its index in the result
+		static Size Lower(const Sequence& seq, const BlockIndex& brackets, Size begin, Size end, const Options& options, Result& result)
+		{
+			const auto index = result.functions.size();
+			result.functions.emplace_back();
+
+			auto function = Lowerer(seq, brackets, options, result).lower(begin, end);
+			result.functions[index] = std::move(function);
+
+			return index;
+		}
+
+	public:
+
+		static Result Lower(const Sequence& seq, const Options& options = {})
+		{
+			Result result;
+			Lower(seq, BlockIndex::Build(seq), 0, seq.size(), options, result);
+			return result;
+		}
+
+		// bytes of a variable-length encoding of both forms, for comparing them: a byte of opcode,
+		// eight bytes per operand of a stack instruction or immediate of a register one (a pool index for a string),
+		// and for a register instruction a byte of source opcode for literals and declarations,
+		// two bytes of result if any and two bytes per operand register after a byte of operand count
+		static Size EncodedSize(const Instruction& instruction)
+		{
+			return 1 + 8 * instruction.oprands().size();
+		}
+
+		static Size EncodedSize(const RegisterInstruction& instruction)
+		{
+			return 1 + (instruction.opcode == RegisterOpcode::Literal || instruction.opcode == RegisterOpcode::Declare ? 1 : 0) +
+				(instruction.result == noRegister ? 0 : 2) + 1 + 2 * instruction.operands.size() + 8 * instruction.immediates.size();
+		}
+	};
+
+	using RegisterInstruction = BasicRegisterInstruction<IRValue>;
+	using RegisterLowering = BasicRegisterLowering<IRValue>;
+}
@@ -0,0 +1,166 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHTHOLLY_SOURCEINDEX_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace Chtholly
+{
+	// Maps offsets of a source text to lines and columns, both starting from 1.
+	// The table of line beginnings is built on the first query, lookups are then binary searches.
+	template <typename inStringView>
+	class BasicSourceIndex
+	{
+	public:
+
+		using StringView = inStringView;
+		using Char = typename StringView::value_type;
+		using Size = std::size_t;
+
+		struct Position
+		{
+			Size line;
+			Size column;
+
+			bool operator==(const Position& other) const
+			{
+				return line == other.line && column == other.column;
+			}
+			bool operator!=(const Position& other) const
+			{
+				return !(*this == other);
+			}
+		};
+
+	private:
+
+		StringView source;
+
+		mutable std::once_flag built;
+		mutable std::vector<Size> lineBegins;
+
+#ifdef CHTHOLLY_SOURCEINDEX_SSE2
+		static Size LowestBit(unsigned mask)
+		{
+#ifdef _MSC_VER
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return bit;
+#else
+			return Size(__builtin_ctz(mask));
+#endif
+		}
+#endif
+
+		// push the offsets following every newline, 16 characters at a time when possible
+		static void ScanNewlines(StringView text, std::vector<Size>& out)
+		{
+			Size i = 0;
+
+#ifdef CHTHOLLY_SOURCEINDEX_SSE2
+			if constexpr (sizeof(Char) == 1)
+			{
+				const auto newline = _mm_set1_epi8('\n');
+				for (; i + 16 <= text.size(); i += 16)
+				{
+					const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+					auto mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+
+					for (; mask != 0; mask &= mask - 1)
+					{
+						out.push_back(i + LowestBit(mask) + 1);
+					}
+				}
+			}
+#endif
+
+			for (; i < text.size(); ++i)
+			{
+				if (text[i] == Char('\n')) out.push_back(i + 1);
+			}
+		}
+
+		void build() const
+		{
+			std::call_once(built, [this] {
+				lineBegins.push_back(0);
+				ScanNewlines(source, lineBegins);
+			});
+		}
+
+	public:
+
+		explicit BasicSourceIndex(StringView inSource) : source(inSource) {}
+
+		BasicSourceIndex(const BasicSourceIndex&) = delete;
+
+		BasicSourceIndex& operator=(const BasicSourceIndex&) = delete;
+
+		Position position(Size offset) const
+		{
+			if (offset > source.size()) throw std::out_of_range("SourceIndex::position: offset out of the source");
+
+			build();
+
+			const auto line = std::upper_bound(lineBegins.begin(), lineBegins.end(), offset) - 1;
+			return { Size(line - lineBegins.begin()) + 1, offset - *line + 1 };
+		}
+
+		// position of the beginning of span, which has to be a part of the source (a ParseUnit value for example)
+		Position position(StringView span) const
+		{
+			if (span.data() < source.data() || span.data() > source.data() + source.size())
+				throw std::out_of_range("SourceIndex::position: span out of the source");
+
+			return position(Size(span.data() - source.data()));
+		}
+
+		Size lineCount() const
+		{
+			build();
+			return lineBegins.size();
+		}
+
+		// the line-th line without its line break
+		StringView line(Size line) const
+		{
+			build();
+
+			if (line == 0 || line > lineBegins.size()) throw std::out_of_range("SourceIndex::line: no such line");
+
+			const auto begin = lineBegins[line - 1];
+			const auto end = line < lineBegins.size() ? lineBegins[line] - 1 : source.size();
+			return source.substr(begin, end - begin);
+		}
+	};
+
+	using SourceIndex = BasicSourceIndex<std::string_view>;
+}
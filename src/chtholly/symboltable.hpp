@@ -0,0 +1,117 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Chtholly
+{
+	using SymbolId = std::uint32_t;
+
+	// Interned spellings with dense 32-bit ids, owned by one module instead of the whole process
+	// (unlike ParseUnitName), so it needs no lock and is freed with the module
+	template <typename inString>
+	class BasicSymbolTable
+	{
+	public:
+
+		using String = inString;
+		using StringView = std::basic_string_view<typename String::value_type>;
+
+		using Id = SymbolId;
+		using Size = std::size_t;
+
+		inline static constexpr Id npos = std::numeric_limits<Id>::max();
+
+	private:
+
+		// std::deque never moves its elements, so the views in ids stay valid
+		std::deque<String> names;
+		std::unordered_map<StringView, Id> ids;
+
+	public:
+
+		BasicSymbolTable() = default;
+
+		BasicSymbolTable(const BasicSymbolTable& src)
+			: names(src.names)
+		{
+			for (Size i = 0; i < names.size(); ++i)
+			{
+				ids.emplace(names[i], Id(i));
+			}
+		}
+
+		BasicSymbolTable(BasicSymbolTable&&) noexcept = default;
+
+		BasicSymbolTable& operator=(const BasicSymbolTable& src)
+		{
+			return *this = BasicSymbolTable(src);
+		}
+
+		BasicSymbolTable& operator=(BasicSymbolTable&&) noexcept = default;
+
+		Id intern(StringView name)
+		{
+			if (auto found = ids.find(name); found != ids.end()) return found->second;
+
+			if (names.size() >= npos)
+			{
+				throw std::length_error("SymbolTable: too many symbols");
+			}
+
+			const auto id = Id(names.size());
+			ids.emplace(names.emplace_back(name), id);
+			return id;
+		}
+
+		// id of an interned name, npos if it was never interned
+		Id find(StringView name) const
+		{
+			auto found = ids.find(name);
+			return found == ids.end() ? npos : found->second;
+		}
+
+		StringView name(Id id) const
+		{
+			return names.at(id);
+		}
+
+		Size size() const
+		{
+			return names.size();
+		}
+
+		// bytes of the spellings, each counted once
+		Size nameBytes() const
+		{
+			Size bytes = 0;
+			for (const auto& name : names) bytes += name.size() * sizeof(typename String::value_type);
+			return bytes;
+		}
+
+		~BasicSymbolTable() = default;
+	};
+
+	using SymbolTable = BasicSymbolTable<std::string>;
+}
@@ -0,0 +1,239 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Chtholly
+{
+	// A pool of worker threads, each with its own task queue.
+	// A worker runs its newest task first and steals the oldest task of another worker when its queue is empty.
+	class ThreadPool
+	{
+	public:
+
+		using Task = std::function<void()>;
+		using Size = std::size_t;
+
+	private:
+
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> workers;
+
+		std::atomic<Size> queued{ 0 };
+		std::atomic<Size> nextQueue{ 0 };
+		std::atomic<bool> stopping{ false };
+
+		std::mutex sleepMutex;
+		std::condition_variable wakeUp;
+
+		// the pool and the queue index of the current thread, if it is a worker
+		static const ThreadPool*& CurrentPool()
+		{
+			thread_local const ThreadPool* pool = nullptr;
+			return pool;
+		}
+
+		static Size& CurrentIndex()
+		{
+			thread_local Size index = 0;
+			return index;
+		}
+
+		bool popBack(Size index, Task& task)
+		{
+			auto& queue = *queues[index];
+			std::lock_guard lock(queue.mutex);
+			if (queue.tasks.empty()) return false;
+
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			return true;
+		}
+
+		bool stealFront(Size index, Task& task)
+		{
+			auto& queue = *queues[index];
+			std::lock_guard lock(queue.mutex);
+			if (queue.tasks.empty()) return false;
+
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+
+		void work(Size index)
+		{
+			CurrentPool() = this;
+			CurrentIndex() = index;
+
+			while (true)
+			{
+				if (runOne()) continue;
+
+				std::unique_lock lock(sleepMutex);
+				wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+				if (stopping && queued == 0) return;
+			}
+		}
+
+	public:
+
+		// a pool without threads runs every task in the thread submitting it
+		explicit ThreadPool(Size threadCount = std::thread::hardware_concurrency())
+		{
+			for (Size i = 0; i < threadCount; ++i) queues.push_back(std::make_unique<Queue>());
+			for (Size i = 0; i < threadCount; ++i) workers.emplace_back([this, i] { work(i); });
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		Size size() const
+		{
+			return workers.size();
+		}
+
+		void submit(Task task)
+		{
+			if (workers.empty())
+			{
+				task();
+				return;
+			}
+
+			const auto index = CurrentPool() == this ? CurrentIndex() : nextQueue++ % queues.size();
+			{
+				auto& queue = *queues[index];
+				std::lock_guard lock(queue.mutex);
+				queue.tasks.push_back(std::move(task));
+			}
+
+			{
+				std::lock_guard lock(sleepMutex);
+				++queued;
+			}
+			wakeUp.notify_one();
+		}
+
+		// Run a queued task in the current thread, own tasks first for a worker; false if there is none
+		bool runOne()
+		{
+			if (queues.empty()) return false;
+
+			const auto self = CurrentPool() == this ? CurrentIndex() : 0;
+
+			Task task;
+			bool found = CurrentPool() == this && popBack(self, task);
+			for (Size i = 0; !found && i < queues.size(); ++i)
+			{
+				found = stealFront((self + i) % queues.size(), task);
+			}
+			if (!found) return false;
+
+			--queued;
+			task();
+			return true;
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard lock(sleepMutex);
+				stopping = true;
+			}
+			wakeUp.notify_all();
+
+			for (auto& worker : workers) worker.join();
+		}
+	};
+
+	// Tasks submitted together; waiting for them runs queued tasks meanwhile,
+	// so a task may wait for the tasks it has submitted without blocking a worker
+	class TaskGroup
+	{
+		ThreadPool& pool;
+
+		std::atomic<ThreadPool::Size> remaining{ 0 };
+
+		std::mutex errorMutex;
+		std::exception_ptr error;
+
+	public:
+
+		explicit TaskGroup(ThreadPool& inPool) : pool(inPool) {}
+
+		TaskGroup(const TaskGroup&) = delete;
+
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+		template <typename F>
+		void run(F&& f)
+		{
+			++remaining;
+			pool.submit([this, f = std::forward<F>(f)]() mutable
+			{
+				try
+				{
+					f();
+				}
+				catch (...)
+				{
+					std::lock_guard lock(errorMutex);
+					if (!error) error = std::current_exception();
+				}
+				--remaining;
+			});
+		}
+
+		// Wait for every task, then rethrow the first exception thrown by one of them
+		void wait()
+		{
+			while (remaining > 0)
+			{
+				if (!pool.runOne()) std::this_thread::yield();
+			}
+
+			if (error) std::rethrow_exception(std::exchange(error, nullptr));
+		}
+
+		~TaskGroup()
+		{
+			while (remaining > 0)
+			{
+				if (!pool.runOne()) std::this_thread::yield();
+			}
+		}
+	};
+}
@@ -0,0 +1,425 @@
+/*
+* Copyright 2019 PragmaTwice
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*		http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parsetree.hpp"
+#include "mappedfile.hpp"
+
+namespace Chtholly
+{
+	// Binary image of a parse tree, in native byte order:
+	//   Header
+	//   Record[nodeCount]                 nodes in pre-order, the user-visible root first
+	//   uint32_t nameOffsets[nameCount+1] offsets of the names in the name bytes
+	//   Char pool[poolSize]               source text, then the values which are not part of the source
+	//   char names[nameBytes]             spellings of the unit names used by the tree
+	namespace TreeImage
+	{
+		using Index = std::uint32_t;
+
+		inline constexpr Index npos = std::numeric_limits<Index>::max();
+
+		inline constexpr std::uint32_t magic = 0x49545043; // "CPTI"
+		inline constexpr std::uint32_t version = 1;
+
+		struct Header
+		{
+			std::uint32_t magic;
+			std::uint32_t version;
+			std::uint32_t charSize;
+			std::uint32_t nodeCount;
+			std::uint32_t nameCount;
+			std::uint32_t poolSize;
+			std::uint32_t nameBytes;
+			std::uint32_t reserved;
+		};
+
+		struct Record
+		{
+			Index parent;
+			Index subtreeEnd;	// index following the last descendant
+			Index prevSibling;
+			Index lastChild;
+			std::uint32_t childCount;
+			std::uint32_t kind;	// name index << 1 | is term
+			std::uint32_t offset;	// value as a span of the pool
+			std::uint32_t length;
+		};
+
+		// Write the tree under root; values pointing into source are stored as offsets of it
+		template <typename Observer, typename StringView>
+		void Write(std::ostream& out, const Observer& root, StringView source)
+		{
+			using Char = typename StringView::value_type;
+
+			std::vector<Record> records;
+			std::vector<std::uint32_t> nameOffsets{ 0 };
+			std::string names;
+			std::unordered_map<ParseUnitName::Id, std::uint32_t> nameIndex;
+			std::basic_string<Char> extra;
+
+			struct Frame
+			{
+				Observer node;
+				Observer child;
+				Index index;
+			};
+
+			std::vector<Frame> pending;
+
+			auto push = [&](const Observer& node, Index parent)
+			{
+				const auto& unit = node.value();
+
+				auto [name, inserted] = nameIndex.emplace(unit.name.id(), std::uint32_t(nameIndex.size()));
+				if (inserted)
+				{
+					names += unit.name.str();
+					nameOffsets.push_back(std::uint32_t(names.size()));
+				}
+
+				std::uint32_t offset;
+				if (unit.value.data() >= source.data() && unit.value.data() + unit.value.size() <= source.data() + source.size() && !unit.value.empty())
+				{
+					offset = std::uint32_t(unit.value.data() - source.data());
+				}
+				else
+				{
+					offset = std::uint32_t(source.size() + extra.size());
+					extra.append(unit.value.data(), unit.value.size());
+				}
+
+				const auto index = Index(records.size());
+				Index prev = npos;
+				if (parent != npos)
+				{
+					prev = records[parent].lastChild;
+					records[parent].lastChild = index;
+					++records[parent].childCount;
+				}
+
+				records.push_back({ parent, npos, prev, npos, 0,
+					name->second << 1 | (unit.type == std::decay_t<decltype(unit)>::Type::term),
+					offset, std::uint32_t(unit.value.size()) });
+				pending.push_back({ node, node.childrenBegin(), index });
+			};
+
+			push(root, npos);
+			while (!pending.empty())
+			{
+				auto& top = pending.back();
+
+				if (top.child != top.node.childrenEnd())
+				{
+					auto child = top.child;
+					++top.child;
+					push(child, top.index);
+				}
+				else
+				{
+					records[top.index].subtreeEnd = Index(records.size());
+					pending.pop_back();
+				}
+			}
+
+			const Header header{ magic, version, std::uint32_t(sizeof(Char)), std::uint32_t(records.size()),
+				std::uint32_t(nameIndex.size()), std::uint32_t(source.size() + extra.size()), std::uint32_t(names.size()), 0 };
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+			out.write(reinterpret_cast<const char*>(nameOffsets.data()), nameOffsets.size() * sizeof(std::uint32_t));
+			out.write(reinterpret_cast<const char*>(source.data()), source.size() * sizeof(Char));
+			out.write(reinterpret_cast<const char*>(extra.data()), extra.size() * sizeof(Char));
+			out.write(names.data(), names.size());
+		}
+	}
+
+	// A read-only parse tree navigating a binary image in place, nothing but the unit names is decoded.
+	// The image is either a caller-owned buffer or a mapped file owned by the view.
+	template <typename inStringView>
+	class BasicParseTreeImage
+	{
+	public:
+
+		using Unit = BasicParseUnit<inStringView>;
+
+		using UnitName = typename Unit::Name;
+		using UnitValue = typename Unit::StringView;
+		using UnitType = typename Unit::Type;
+
+		using Char = typename UnitValue::value_type;
+		using Index = TreeImage::Index;
+		using Size = std::size_t;
+
+		inline static constexpr Index npos = TreeImage::npos;
+
+	private:
+
+		using Header = TreeImage::Header;
+		using Record = TreeImage::Record;
+
+		MappedFile file;
+
+		const Record* records = nullptr;
+		Index nodeCount = 0;
+		const Char* pool = nullptr;
+
+		std::vector<UnitName> names;
+
+		[[noreturn]] static void Fail(const char* reason)
+		{
+			throw std::runtime_error(std::string("ParseTreeImage: ") + reason);
+		}
+
+		void load(const char* data, Size size)
+		{
+			if (size < sizeof(Header)) Fail("truncated header");
+			if (reinterpret_cast<std::uintptr_t>(data) % alignof(Record) != 0) Fail("misaligned image");
+
+			Header header;
+			std::memcpy(&header, data, sizeof(Header));
+
+			if (header.magic != TreeImage::magic) Fail("bad magic number");
+			if (header.version != TreeImage::version) Fail("unsupported version");
+			if (header.charSize != sizeof(Char)) Fail("mismatched character size");
+			if (header.nodeCount == 0) Fail("empty tree");
+
+			const auto recordsOffset = sizeof(Header);
+			const auto offsetsOffset = recordsOffset + Size(header.nodeCount) * sizeof(Record);
+			const auto poolOffset = offsetsOffset + (Size(header.nameCount) + 1) * sizeof(std::uint32_t);
+			const auto namesOffset = poolOffset + Size(header.poolSize) * sizeof(Char);
+			if (namesOffset + header.nameBytes > size) Fail("truncated image");
+
+			records = reinterpret_cast<const Record*>(data + recordsOffset);
+			nodeCount = header.nodeCount;
+			pool = reinterpret_cast<const Char*>(data + poolOffset);
+
+			const auto nameOffsets = reinterpret_cast<const std::uint32_t*>(data + offsetsOffset);
+			names.reserve(header.nameCount);
+			for (Index i = 0; i < header.nameCount; ++i)
+			{
+				if (nameOffsets[i] > nameOffsets[i + 1] || nameOffsets[i + 1] > header.nameBytes) Fail("bad name table");
+				names.emplace_back(std::string_view(data + namesOffset + nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i]));
+			}
+
+			// validate the links once, so that navigation doesn't need any check
+			std::vector<std::uint32_t> childCounts(nodeCount, 0);
+			for (Index i = 0; i < nodeCount; ++i)
+			{
+				const auto& record = records[i];
+
+				if ((i == 0) != (record.parent == npos) || (i != 0 && record.parent >= i)) Fail("bad parent link");
+
+				const auto parentEnd = record.parent == npos ? nodeCount : records[record.parent].subtreeEnd;
+				if (record.subtreeEnd <= i || record.subtreeEnd > parentEnd) Fail("bad subtree end");
+
+				if (record.prevSibling == npos ? (i != 0 && record.parent + 1 != i)
+					: (record.prevSibling >= i || records[record.prevSibling].parent != record.parent || records[record.prevSibling].subtreeEnd != i)) Fail("bad sibling link");
+
+				if ((record.lastChild == npos) != (record.subtreeEnd == i + 1)) Fail("bad child link");
+				if (record.lastChild != npos && (record.lastChild <= i || record.lastChild >= record.subtreeEnd
+					|| records[record.lastChild].parent != i || records[record.lastChild].subtreeEnd != record.subtreeEnd)) Fail("bad child link");
+
+				if ((record.kind >> 1) >= header.nameCount) Fail("bad name index");
+				if (Size(record.offset) + record.length > header.poolSize) Fail("bad value span");
+
+				if (i != 0) ++childCounts[record.parent];
+			}
+			for (Index i = 0; i < nodeCount; ++i)
+			{
+				if (records[i].childCount != childCounts[i]) Fail("bad child count");
+			}
+			if (records[0].subtreeEnd != nodeCount) Fail("trailing nodes");
+		}
+
+	public:
+
+		class Observer
+		{
+		protected:
+
+			const BasicParseTreeImage* tree = nullptr;
+
+			Index parentIndex = npos;
+			Index nodeIndex = npos;
+
+			Observer(const BasicParseTreeImage* inTree, Index inParent, Index inNode)
+				: tree(inTree), parentIndex(inParent), nodeIndex(inNode) {}
+
+			const Record& node() const
+			{
+				return tree->records[nodeIndex];
+			}
+
+			// the root has no parent record, its sibling range ends with the image
+			Index siblingsEnd() const
+			{
+				return parentIndex == npos ? tree->nodeCount : tree->records[parentIndex].subtreeEnd;
+			}
+
+			friend class BasicParseTreeImage<inStringView>;
+
+		public:
+
+			Observer() {}
+			Observer(const Observer& src) = default;
+
+			Observer& operator=(const Observer& src) = default;
+
+			bool operator==(const Observer& other) const
+			{
+				return tree == other.tree && parentIndex == other.parentIndex && nodeIndex == other.nodeIndex;
+			}
+			bool operator!=(const Observer& other) const
+			{
+				return !(*this == other);
+			}
+
+			Observer& operator++()
+			{
+				const auto next = node().subtreeEnd;
+				nodeIndex = next == siblingsEnd() ? npos : next;
+				return *this;
+			}
+			Observer& operator--()
+			{
+				nodeIndex = nodeIndex == npos
+					? (parentIndex == npos ? 0 : tree->records[parentIndex].lastChild)
+					: node().prevSibling;
+				return *this;
+			}
+
+			bool childrenEmpty() const
+			{
+				return node().lastChild == npos;
+			}
+
+			Size thisSize() const
+			{
+				return parentIndex == npos ? 1 : tree->records[parentIndex].childCount;
+			}
+			Size childrenSize() const
+			{
+				return node().childCount;
+			}
+
+			Observer parent() const
+			{
+				return { tree, tree->records[parentIndex].parent, parentIndex };
+			}
+
+			Observer thisBegin() const
+			{
+				return { tree, parentIndex, parentIndex == npos ? 0 : parentIndex + 1 };
+			}
+			Observer thisEnd() const
+			{
+				return { tree, parentIndex, npos };
+			}
+			Observer thisNext() const
+			{
+				auto temp = *this;
+				return ++temp;
+			}
+			Observer thisPrev() const
+			{
+				auto temp = *this;
+				return --temp;
+			}
+
+			Observer childrenBegin() const
+			{
+				return { tree, nodeIndex, childrenEmpty() ? npos : nodeIndex + 1 };
+			}
+			Observer childrenEnd() const
+			{
+				return { tree, nodeIndex, npos };
+			}
+
+			// units are decoded on access, the value refers to the image
+			Unit value() const
+			{
+				return tree->unit(nodeIndex);
+			}
+
+			Unit childrenFrontValue() const
+			{
+				return tree->unit(nodeIndex + 1);
+			}
+
+			Unit childrenBackValue() const
+			{
+				return tree->unit(node().lastChild);
+			}
+
+			~Observer() = default;
+		};
+
+		// View a buffer holding an image, which has to outlive the view
+		BasicParseTreeImage(const void* data, Size size)
+		{
+			load(static_cast<const char*>(data), size);
+		}
+
+		// Map an image file, owned by the view
+		explicit BasicParseTreeImage(const std::string& path) : file(path)
+		{
+			load(file.data(), file.size());
+		}
+
+		// observers refer to the view, so it is neither copyable nor movable
+		BasicParseTreeImage(const BasicParseTreeImage&) = delete;
+
+		BasicParseTreeImage& operator=(const BasicParseTreeImage&) = delete;
+
+		Unit unit(Index index) const
+		{
+			const auto& record = records[index];
+			return { record.kind & 1 ? UnitType::term : UnitType::token, names[record.kind >> 1], UnitValue(pool + record.offset, record.length) };
+		}
+
+		Observer observer() const
+		{
+			return { this, npos, 0 };
+		}
+
+		// number of nodes
+		Size size() const
+		{
+			return nodeCount;
+		}
+
+		~BasicParseTreeImage() = default;
+	};
+
+	using ParseTreeImage = BasicParseTreeImage<std::string_view>;
+
+	template <typename StringView, typename Allocator>
+	void WriteParseTreeImage(std::ostream& out, const BasicParseTree<StringView, Allocator>& tree, StringView source = {})
+	{
+		TreeImage::Write(out, tree.observer(), source);
+	}
+}
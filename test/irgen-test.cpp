@@ -3,65 +3,46 @@
 
 #include <gtest/gtest.h>
 #include <chtholly/irgenerator.hpp>
+#include <chtholly/flattree.hpp>
+#include <chtholly/treeimage.hpp>
+#include <chtholly/fusedirgen.hpp>
+#include <chtholly/bytecode.hpp>
+#include <chtholly/linker.hpp>
+#include <chtholly/irtext.hpp>
+#include <chtholly/optimizer.hpp>
+#include <chtholly/controlflow.hpp>
+#include <chtholly/registerir.hpp>
+#include <chtholly/parser.hpp>
+
+#include <algorithm>
+#include <clocale>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
 
 using namespace Chtholly;
 
 using namespace std::string_literals;
 
-template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
-template<class... Ts> overloaded(Ts...)->overloaded<Ts...>;
-
-std::string OpcodeToString(std::size_t code)
+std::string ToString(const Instruction& i)
 {
-#define OpcodeStrPair(func) { Opcode<&Instruction::func>(), #func }
-	return std::map<std::size_t, std::string> {
-		OpcodeStrPair(None), 
-		OpcodeStrPair(Block::Begin), OpcodeStrPair(Block::NamedBegin),
-		OpcodeStrPair(Block::Drop), OpcodeStrPair(Block::End),
-		OpcodeStrPair(Function::Begin), OpcodeStrPair(Function::End), OpcodeStrPair(Function::Call),
-		OpcodeStrPair(List::Push), OpcodeStrPair(List::Pop),
-		OpcodeStrPair(Control::Jump), OpcodeStrPair(Control::JumpIf),
-		OpcodeStrPair(Control::JumpIfElse), OpcodeStrPair(Control::Mark),
-		OpcodeStrPair(Object::Begin), OpcodeStrPair(Object::End), 
-		OpcodeStrPair(Object::EndWithInit), OpcodeStrPair(Object::AttachTo),
-		OpcodeStrPair(Object::Var), OpcodeStrPair(Object::VarWithConstraint),
-		OpcodeStrPair(Object::VarPack), OpcodeStrPair(Object::VarPackWithConstraint),
-		OpcodeStrPair(Object::Const), OpcodeStrPair(Object::ConstWithConstraint),
-		OpcodeStrPair(Object::ConstPack), OpcodeStrPair(Object::ConstPackWithConstraint),
-		OpcodeStrPair(Object::Use),
-		OpcodeStrPair(Literal::Int), OpcodeStrPair(Literal::Float),
-		OpcodeStrPair(Literal::String), OpcodeStrPair(Literal::Bool),
-		OpcodeStrPair(Literal::Null), OpcodeStrPair(Literal::Undef),
-	}.at(code);
-#undef OpcodeStrPair
+	std::string out;
+	IRText::Disassemble(i, out);
+	return out;
 }
 
-std::string ToString(const Instruction& i)
+// IRGenerator, checking that the text form of every generated sequence assembles back to it
+struct TextRoundTrip
 {
-	std::string out;
-	out += OpcodeToString(i.opcode());
-	if (!i.oprands().empty())
+	static IRGenerator::Sequence Generate(const ParseTree& tree)
 	{
-		out += "(";
-		bool first = true;
-		for (const auto& v : i.oprands())
-		{
-			if (!first) out += ",";
-			else first = false;
-			out += std::visit(overloaded{
-				[](IRValue::Undef arg) { return "undef"s; },
-				[](IRValue::Null arg) { return "null"s; },
-				[](IRValue::Bool arg) { return arg ? "true"s : "false"s; },
-				[](IRValue::Int arg) { return std::to_string(arg); },
-				[](IRValue::Float arg) { return std::to_string(arg); },
-				[](IRValue::String arg) { return Conv<Unquoted<IRValue::String>>::To<std::string>(arg); },
-				}, static_cast<IRValue::Base>(v));
-		}
-		out += ")";
+		auto seq = IRGenerator::Generate(tree);
+		EXPECT_EQ(IRText::Assemble(IRText::Disassemble(seq)), seq);
+		return seq;
 	}
-
-	return out;
-}
+};
 
 std::ostream& operator<<(std::ostream& out, const Instruction& i)
 {
@@ -71,74 +52,74 @@ std::ostream& operator<<(std::ostream& out, const Instruction& i)
 
 TEST(Token, IntLiteral)
 {
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("IntLiteral", "1"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("IntLiteral", "1"))), IRGenerator::Sequence{
 		Instruction::Literal::Int(1)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("IntLiteral", "1234567890"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("IntLiteral", "1234567890"))), IRGenerator::Sequence{
 		Instruction::Literal::Int(1234567890)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("IntLiteral", "7829438592814723468"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("IntLiteral", "7829438592814723468"))), IRGenerator::Sequence{
 		Instruction::Literal::Int(7829438592814723468ll)
 	});
 }
 
 TEST(Token, FloatLiteral)
 {
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("FloatLiteral", "1."))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("FloatLiteral", "1."))), IRGenerator::Sequence{
 		Instruction::Literal::Float(1)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("FloatLiteral", "01.e0222"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("FloatLiteral", "01.e0222"))), IRGenerator::Sequence{
 		Instruction::Literal::Float(01.e0222)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("FloatLiteral", "2.345"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("FloatLiteral", "2.345"))), IRGenerator::Sequence{
 		Instruction::Literal::Float(2.345)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("FloatLiteral", "6.78e-90"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("FloatLiteral", "6.78e-90"))), IRGenerator::Sequence{
 		Instruction::Literal::Float(6.78e-90)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("FloatLiteral", "234235.345323333333e+34"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("FloatLiteral", "234235.345323333333e+34"))), IRGenerator::Sequence{
 		Instruction::Literal::Float(234235.345323333333e+34)
 	});
 }
 
 TEST(Token, StringLiteral)
 {
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("StringLiteral", R"("hello")"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("StringLiteral", R"("hello")"))), IRGenerator::Sequence{
 		Instruction::Literal::String("hello")
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("StringLiteral", R"("\thello\n\"")"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("StringLiteral", R"("\thello\n\"")"))), IRGenerator::Sequence{
 		Instruction::Literal::String("\thello\n\"")
 	});
 }
 
 TEST(Token, IdentifierLiteral)
 {
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("NullLiteral", "null"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("NullLiteral", "null"))), IRGenerator::Sequence{
 		Instruction::Literal::Null()
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("UndefinedLiteral", "undef"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("UndefinedLiteral", "undef"))), IRGenerator::Sequence{
 		Instruction::Literal::Undef()
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("TrueLiteral", "true"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("TrueLiteral", "true"))), IRGenerator::Sequence{
 		Instruction::Literal::Bool(true)
 	});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("FalseLiteral", "false"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("FalseLiteral", "false"))), IRGenerator::Sequence{
 		Instruction::Literal::Bool(false)
 	});
 }
 
 TEST(Token, Identifier)
 {
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("Identifier", "a"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("Identifier", "a"))), IRGenerator::Sequence{
 		Instruction::Object::Use("a")
 		});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("Identifier", "integer_container"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("Identifier", "integer_container"))), IRGenerator::Sequence{
 		Instruction::Object::Use("integer_container")
 		});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("Identifier", "_Static_assert"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("Identifier", "_Static_assert"))), IRGenerator::Sequence{
 		Instruction::Object::Use("_Static_assert")
 		});
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Token("Identifier", "iHave100AppleForYou"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Token("Identifier", "iHave100AppleForYou"))), IRGenerator::Sequence{
 		Instruction::Object::Use("iHave100AppleForYou")
 		});
 }
@@ -163,7 +144,7 @@ TEST(Expression, ExpressionOfLiteral)
 		Instruction::Block::End()
 	};
 
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Term("Expression",
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Term("Expression",
 		Token("FloatLiteral", "1.0"),
 		Token("Separator", ";"),
 		Token("FloatLiteral", "2.0"),
@@ -198,7 +179,7 @@ TEST(Expression, ExpressionOfLiteral)
 		Instruction::Block::End()
 	};
 	
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Term("Expression",
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Term("Expression",
 		Token("FloatLiteral", "1.0"),
 		Token("Separator", ";"),
 		Token("FloatLiteral", "2.0"),
@@ -229,7 +210,7 @@ TEST(Expression, ArrayListOfLiteral)
 		Instruction::Function::Call()
 	};
 
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Term("ArrayList",
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Term("ArrayList",
 		Token("FloatLiteral", "1.0"),
 		Token("FloatLiteral", "2.0"),
 		Token("NullLiteral", "null"),
@@ -253,7 +234,7 @@ TEST(Expression, ArrayListOfLiteral)
 	Instruction::Function::Call()
 	};
 
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Term("ArrayList",
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Term("ArrayList",
 		Token("FloatLiteral", "1.0"),
 		Token("FloatLiteral", "2.0"),
 		Token("NullLiteral", "null"),
@@ -269,7 +250,7 @@ TEST(Expression, ArrayListOfLiteral)
 
 TEST(Expression, UndefExpression)
 {
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(Term("UndefExpression"))), IRGenerator::Sequence{
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(Term("UndefExpression"))), IRGenerator::Sequence{
 		Instruction::Literal::Undef() 
 	});
 }
@@ -281,7 +262,7 @@ TEST(Expression, DefineExpression)
 			Instruction::Object::Var("a"),
 			Instruction::Object::End()
 	};
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("VarDefineExpression",
 			Term("ConstraintExpression",
 				Token("Identifier", "a")
@@ -295,7 +276,7 @@ TEST(Expression, DefineExpression)
 			Instruction::Object::VarWithConstraint("number"),
 			Instruction::Object::End()
 	};
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("VarDefineExpression",
 			Term("ConstraintExpression",
 				Token("Identifier", "number"),
@@ -318,7 +299,7 @@ TEST(Expression, DefineExpression)
 			Instruction::Block::End(),
 			Instruction::Object::End()
 	};
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("VarDefineExpression",
 			Term("PatternExpression",
 				Term("ConstraintExpressionAtPatternExpression",
@@ -352,7 +333,7 @@ TEST(Expression, DefineExpression)
 			Instruction::Block::End(),
 			Instruction::Object::End()
 	};
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("ConstDefineExpression",
 			Term("PatternExpression",
 				Term("ConstraintExpressionAtPatternExpression",
@@ -378,7 +359,7 @@ TEST(Expression, DefineExpression)
 			Instruction::Literal::Int(1),
 			Instruction::Object::EndWithInit()
 	};
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("VarDefineExpression",
 			Term("ConstraintExpression",
 				Token("Identifier", "a")
@@ -416,7 +397,7 @@ TEST(Expression, DefineExpression)
 			Instruction::Block::End(),
 			Instruction::Object::EndWithInit()
 	};
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("VarDefineExpression",
 			Term("PatternExpression",
 				Term("ConstraintExpressionAtPatternExpression",
@@ -459,7 +440,7 @@ TEST(Expression, LambdaExpression)
 			Instruction::Function::End()
 	};
 
-	EXPECT_EQ(IRGenerator::Generate(ParseTree(
+	EXPECT_EQ(TextRoundTrip::Generate(ParseTree(
 		Term("LambdaExpression",
 			Term("PatternExpression",
 				Term("ConstraintExpressionAtPatternExpression", Token("Identifier", "x"))
@@ -468,3 +449,919 @@ TEST(Expression, LambdaExpression)
 		)
 	)), seq_1);
 }
+
+TEST(Tree, FlatParseTree)
+{
+	const auto tree = ParseTree(
+		Term("VarDefineExpression",
+			Term("PatternExpression",
+				Term("ConstraintExpressionAtPatternExpression",
+					Token("Identifier", "a")
+				),
+				Token("Separator", ","),
+				Term("ConstraintExpressionAtPatternExpression",
+					Token("Identifier", "c"),
+					Token("Separator", "...")
+				)
+			),
+			Term("Expression",
+				Token("IntLiteral", "1"),
+				Token("Separator", ";"),
+				Term("ArrayList",
+					Token("FloatLiteral", "2.33"),
+					Token("NullLiteral", "null")
+				)
+			)
+		));
+
+	using FlatIRGenerator = BasicIRGenerator<std::string_view, FlatParseTree>;
+
+	EXPECT_EQ(FlatIRGenerator::Generate(FlatParseTree(tree)), IRGenerator::Generate(tree));
+}
+
+TEST(Tree, ParseTreeImage)
+{
+	const std::string_view source = "var (a, c...) (1; [2.33, null, \"s\"])";
+
+	ParseTree tree;
+	Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+
+	std::ostringstream out(std::ios::binary);
+	WriteParseTreeImage(out, tree, source);
+	const auto bytes = out.str();
+
+	std::vector<std::uint32_t> buffer(bytes.size() / sizeof(std::uint32_t) + 1);
+	std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+	using ImageIRGenerator = BasicIRGenerator<std::string_view, ParseTreeImage>;
+
+	EXPECT_EQ(ImageIRGenerator::Generate(ParseTreeImage(buffer.data(), bytes.size())), IRGenerator::Generate(tree));
+}
+
+TEST(IRGenerator, Dispatch)
+{
+	EXPECT_TRUE(IRGenerator::Supports(ParseUnitName::Predefined("VarDefineExpression")));
+	EXPECT_FALSE(IRGenerator::Supports(ParseUnitName::Predefined("ConditionExpression")));
+	EXPECT_FALSE(IRGenerator::Supports("SomeUserDefinedTerm"));
+
+	EXPECT_THROW(IRGenerator::MakeTable({ { "SomeUserDefinedTerm", nullptr } }), std::invalid_argument);
+
+	EXPECT_THROW(IRGenerator::Generate(ParseTree(Term("ConditionExpression", Token("TrueLiteral", "true")))), std::invalid_argument);
+
+	// found up front, even after generated units and under a supported one
+	const ParseTree nested(Term("Expression", Token("IntLiteral", "1"), Token("Separator", ";"), Term("ArrayList", Term("PointExpression", Token("Identifier", "a"), Token("Identifier", "b")))));
+	EXPECT_THROW(IRGenerator::Check(nested.observer().childrenBegin()), std::invalid_argument);
+	EXPECT_NO_THROW(IRGenerator::Check(ParseTree(Term("Expression", Token("IntLiteral", "1"), Token("Separator", ";"), Token("IntLiteral", "2"))).observer().childrenBegin()));
+}
+
+TEST(Instruction, Opcode)
+{
+	static_assert(Opcode<&Instruction::None>() == OpcodeId::None);
+	static_assert(Opcode<&Instruction::Block::Begin>() == OpcodeId::BlockBegin);
+	static_assert(Opcode<&Instruction::Literal::Undef>() == OpcodeId::LiteralUndef);
+	static_assert(OpcodeName(OpcodeId::ControlJumpIfElse) == "Control::JumpIfElse");
+	static_assert(sizeof(OpcodeId) == 1);
+
+	// dense: every opcode below opcodeCount has a distinct name
+	EXPECT_EQ(std::size_t(OpcodeId::LiteralConstant) + 1, opcodeCount);
+	EXPECT_EQ(std::set<std::string_view>(std::begin(opcodeNames), std::end(opcodeNames)).size(), opcodeCount);
+	EXPECT_EQ(OpcodeName(OpcodeId(opcodeCount)), "");
+
+	EXPECT_EQ(Instruction::Function::Call().opcode(), OpcodeId::FunctionCall);
+	EXPECT_EQ(Instruction::Object::Use("x").opcode(), Opcode<&Instruction::Object::Use>());
+	EXPECT_NE(Instruction::Block::End().opcode(), Instruction::Function::End().opcode());
+}
+
+TEST(Automaton, TableAutomaton)
+{
+	enum class Parity { even, odd, stop };
+
+	// count the characters until a '.'
+	constexpr TableAutomaton<Parity, 3, std::size_t, std::string_view::const_iterator> parity{ Parity::even, Parity::stop, {
+		[](std::size_t& count, std::string_view::const_iterator it) { ++count; return *it == '.' ? Parity::stop : Parity::odd; },
+		[](std::size_t& count, std::string_view::const_iterator it) { ++count; return *it == '.' ? Parity::stop : Parity::even; },
+		[](std::size_t&, std::string_view::const_iterator) { return Parity::stop; }
+	} };
+
+	const std::string_view input = "abcde.fg";
+
+	std::size_t count = 0;
+	EXPECT_EQ(parity(count, input.begin(), input.end()), Parity::stop);
+	EXPECT_EQ(count, 6);
+
+	count = 0;
+	EXPECT_EQ(parity(count, input.begin(), input.begin() + 3), Parity::odd);
+	EXPECT_EQ(count, 3);
+}
+
+TEST(IRGenerator, Fused)
+{
+	for (std::string_view source : {
+		"1",
+		"a; b, c;",
+		"1,; 2",
+		"var (a, c...) (1; [2.33, null, \"s\"])",
+		"const x [a, b]; var (y) (); [1, [2, [3]]],",
+		"x, [y]; (z)"
+	})
+	{
+		ParseTree tree;
+		Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+
+		EXPECT_EQ(FusedIRGenerator::Generate(source), IRGenerator::Generate(tree)) << source;
+	}
+
+	// a term left by a failed parse can't be generated either way
+	EXPECT_THROW(FusedIRGenerator::Generate("a; [b, c"), std::invalid_argument);
+}
+
+TEST(Instruction, PackedSequence)
+{
+	for (std::string_view source : {
+		"1",
+		"var (a, c...) (1; [2.33, null, \"s\"])",
+		"const x [a, b]; var (y) (); [1, [2, [3]]], x, a"
+	})
+	{
+		ParseTree tree;
+		Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+
+		const auto seq = IRGenerator::Generate(tree);
+		const PackedSequence packed(seq);
+
+		EXPECT_EQ(packed.size(), seq.size());
+		EXPECT_EQ(packed.unpack(), seq) << source;
+	}
+
+	PackedSequence packed;
+	packed.push_back(Instruction::Object::Use("x"));
+	packed.push_back(Instruction::Object::Use("x"));
+	packed.push_back(Instruction::Literal::Float(2.5));
+	packed.push_back(Instruction::Literal::Int(-(IRValue::Int(1) << 40)));
+	packed.push_back(Instruction::Control::JumpIfElse("then", "else"));
+
+	// the second slot is only 32 bits wide, so these go to the pool
+	const auto wide = Instruction::Make(OpcodeId::None, { IRValue::Int(1) << 40, 0.5 });
+	const auto narrow = Instruction::Make(OpcodeId::None, { true, IRValue::Int(-7) });
+	const auto large = Instruction::Make(OpcodeId::None, { nullptr, IRValue::Int(1) << 40 });
+	packed.push_back(wide);
+	packed.push_back(narrow);
+	packed.push_back(large);
+
+	EXPECT_EQ(packed.unpack(0), Instruction::Object::Use("x"));
+	EXPECT_EQ(packed[0], packed[1]);
+	EXPECT_EQ(packed.stringOperand(packed[4], 1), "else");
+	EXPECT_THROW(packed.stringOperand(packed[2], 0), std::invalid_argument);
+	EXPECT_EQ(packed.unpack(2), Instruction::Literal::Float(2.5));
+	EXPECT_EQ(packed.unpack(3), Instruction::Literal::Int(-(IRValue::Int(1) << 40)));
+	EXPECT_EQ(packed.unpack(5), wide);
+	EXPECT_EQ(packed.unpack(6), narrow);
+	EXPECT_EQ(packed.unpack(7), large);
+
+	EXPECT_EQ(packed.constants().stringCount(), 0);
+	EXPECT_EQ(packed.constants().intCount(), 1);
+	EXPECT_EQ(packed.constants().floatCount(), 1);
+	EXPECT_EQ(packed[5].kinds[0], OperandKind::integer);
+	EXPECT_EQ(packed[5].kinds[1], OperandKind::floatingPool);
+	EXPECT_EQ(packed[6].kinds[1], OperandKind::integer);
+	EXPECT_EQ(packed[7].kinds[1], OperandKind::integerPool);
+
+	const auto copy = packed;
+	EXPECT_EQ(copy.unpack(), packed.unpack());
+
+	EXPECT_THROW(packed.push_back(Instruction::Make(OpcodeId::None, { 1, 2, 3 })), std::length_error);
+}
+
+TEST(Instruction, Symbols)
+{
+	static_assert(HasSymbolOprands(OpcodeId::ObjectUse));
+	static_assert(!HasSymbolOprands(OpcodeId::LiteralString));
+
+	PackedSequence packed({
+		Instruction::Object::Var("value"),
+		Instruction::Literal::String("value"),
+		Instruction::Block::NamedBegin("loop"),
+		Instruction::Object::Use("value"),
+		Instruction::Control::JumpIfElse("loop", "value"),
+	});
+
+	// identifiers are interned once, string literals stay in the constant pool
+	EXPECT_EQ(packed.symbols().size(), 2);
+	EXPECT_EQ(packed.constants().stringCount(), 1);
+	EXPECT_EQ(packed[1].kinds[0], OperandKind::string);
+	EXPECT_EQ(packed[3].kinds[0], OperandKind::symbol);
+
+	EXPECT_EQ(packed.symbolOperand(packed[0], 0), packed.symbolOperand(packed[3], 0));
+	EXPECT_EQ(packed.symbolOperand(packed[4], 1), packed.symbolOperand(packed[0], 0));
+	EXPECT_EQ(packed.symbolOperand(packed[4], 0), packed.symbols().find("loop"));
+	EXPECT_EQ(packed.symbols().find("missing"), SymbolTable::npos);
+	EXPECT_EQ(packed.symbols().name(packed.symbolOperand(packed[2], 0)), "loop");
+	EXPECT_EQ(packed.stringOperand(packed[3], 0), "value");
+	EXPECT_THROW(packed.symbolOperand(packed[1], 0), std::invalid_argument);
+
+	EXPECT_EQ(packed.unpack(4), Instruction::Control::JumpIfElse("loop", "value"));
+
+	SymbolTable table;
+	EXPECT_EQ(table.intern("a"), 0);
+	EXPECT_EQ(table.intern("b"), 1);
+	EXPECT_EQ(table.intern("a"), 0);
+	EXPECT_EQ(table.nameBytes(), 2);
+
+	const auto copy = table;
+	EXPECT_EQ(copy.find("b"), 1);
+}
+
+TEST(Instruction, BytecodeModule)
+{
+	const std::string_view source = "var (a, c...) (1; [2.33, null, \"s\"]); const x [a, c]; x, a";
+
+	ParseTree tree;
+	Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+
+	const auto seq = IRGenerator::Generate(tree);
+	PackedSequence packed(seq);
+	packed.push_back(Instruction::Make(OpcodeId::None, { IRValue::Int(1) << 40, IRValue::Int(-(IRValue::Int(1) << 40)) }));
+	packed.push_back(Instruction::Make(OpcodeId::None, { false, 0.25 }));
+
+	std::vector<std::uint32_t> sourceMap(packed.size(), BytecodeModule::npos);
+	sourceMap[0] = 0;
+
+	std::ostringstream out(std::ios::binary);
+	BytecodeImage::Write(out, packed, sourceMap);
+	const auto bytes = out.str();
+
+	std::vector<std::uint64_t> buffer(bytes.size() / sizeof(std::uint64_t) + 1);
+	std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+	{
+		const BytecodeModule module(buffer.data(), bytes.size());
+
+		EXPECT_EQ(module.unpack(), packed.unpack());
+		EXPECT_EQ(module.size(), packed.size());
+		EXPECT_EQ(module.symbolCount(), packed.symbols().size());
+		const auto var = std::find_if(packed.instructions().begin(), packed.instructions().end(),
+			[](const PackedInstruction& i) { return i.opcode == OpcodeId::ObjectVar; }) - packed.instructions().begin();
+		EXPECT_EQ(module.symbolOperand(module[var], 0), packed.symbolOperand(packed[var], 0));
+		EXPECT_EQ(module.stringOperand(module[var], 0), "a");
+		EXPECT_TRUE(module.hasSourceMap());
+		EXPECT_EQ(module.sourceOffset(0), 0);
+		EXPECT_EQ(module.sourceOffset(1), BytecodeModule::npos);
+		EXPECT_TRUE(std::equal(module.begin(), module.end(), packed.instructions().begin()));
+	}
+
+	const std::string path = "bytecode-module-test.bin";
+	std::ofstream(path, std::ios::binary) << bytes;
+	{
+		const BytecodeModule mapped(path);
+		EXPECT_EQ(mapped.unpack(), packed.unpack());
+	}
+	std::remove(path.c_str());
+
+	auto corrupt = [&](std::size_t offset, std::uint8_t byte)
+	{
+		auto copy = buffer;
+		reinterpret_cast<std::uint8_t*>(copy.data())[offset] = byte;
+		return copy;
+	};
+
+	const auto codeOffset = sizeof(BytecodeImage::Header);
+	const auto firstKind = codeOffset + offsetof(PackedInstruction, kinds);
+
+	EXPECT_THROW(BytecodeModule(corrupt(0, 0).data(), bytes.size()), std::runtime_error);
+	EXPECT_THROW(BytecodeModule(buffer.data(), bytes.size() - 1), std::runtime_error);
+	EXPECT_THROW(BytecodeModule(corrupt(codeOffset, 0xff).data(), bytes.size()), std::runtime_error);
+	EXPECT_THROW(BytecodeModule(corrupt(firstKind, std::uint8_t(OperandKind::string)).data(), bytes.size()), std::runtime_error);
+	EXPECT_THROW(BytecodeModule(corrupt(firstKind + 1, std::uint8_t(OperandKind::null)).data(), bytes.size()), std::runtime_error);
+
+	PackedSequence empty;
+	std::ostringstream emptyOut(std::ios::binary);
+	BytecodeImage::Write(emptyOut, empty);
+	const auto emptyBytes = emptyOut.str();
+	std::vector<std::uint64_t> emptyBuffer(emptyBytes.size() / sizeof(std::uint64_t) + 1);
+	std::memcpy(emptyBuffer.data(), emptyBytes.data(), emptyBytes.size());
+
+	const BytecodeModule emptyModule(emptyBuffer.data(), emptyBytes.size());
+	EXPECT_EQ(emptyModule.size(), 0);
+	EXPECT_FALSE(emptyModule.hasSourceMap());
+}
+
+TEST(Instruction, Link)
+{
+	using I = Instruction;
+
+	const std::vector<Instruction> seq = {
+		I::Control::Mark("begin"),
+		I::Object::Use("x"),
+		I::Control::JumpIfElse("then", "end"),
+		I::Control::Mark("then"),
+		I::Literal::Int(1),
+		I::Control::JumpIf("begin"),
+		I::Control::Jump("end"),
+		I::Control::Mark("end"),
+	};
+
+	const std::vector<Instruction> linked = {
+		I::Object::Use("x"),
+		I::Control::JumpIfElseTo(2, 5),
+		I::Literal::Int(1),
+		I::Control::JumpIfTo(0),
+		I::Control::JumpTo(5),
+	};
+
+	EXPECT_EQ(Linker::Link(seq), linked);
+	EXPECT_EQ(OpcodeName(linked[1].opcode()), "Control::JumpIfElseTo");
+	EXPECT_EQ(PackedSequence(linked).unpack(), linked);
+
+	try
+	{
+		Linker::Link({
+			I::Control::Mark("a"), I::Control::Jump("b"), I::Control::Mark("a"),
+			I::Control::JumpIfElse("c", "b"), I::Control::Mark("a"),
+		});
+		FAIL() << "expected a LinkError";
+	}
+	catch (const LinkError& e)
+	{
+		EXPECT_EQ(e.duplicateTags(), std::vector<std::string>{ "a" });
+		EXPECT_EQ(e.missingTags(), (std::vector<std::string>{ "b", "c" }));
+		EXPECT_STREQ(e.what(), "Linker: duplicate tags 'a' missing tags 'b' 'c'");
+	}
+}
+
+TEST(Instruction, BlockIndex)
+{
+	const std::string_view source = "var (a, c...) (1; [2.33, null, \"s\"]); const x [a, [c]]; (1), [x]";
+
+	ParseTree tree;
+	Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+
+	BlockIndex index;
+	const auto seq = IRGenerator::Generate(tree, index);
+	ASSERT_EQ(index.size(), seq.size());
+	EXPECT_TRUE(index.complete());
+
+	// filled while emitting, the same as an index built afterwards, and reset when reused
+	const auto built = BlockIndex::Build(seq);
+	for (std::size_t i = 0; i < seq.size(); ++i)
+	{
+		EXPECT_EQ(index.partner(i), built.partner(i));
+		EXPECT_EQ(index.depth(i), built.depth(i));
+	}
+	EXPECT_EQ(IRGenerator::Generate(tree, index).size(), index.size());
+
+	// compare with a linear scan counting the nesting
+	for (std::size_t i = 0; i < seq.size(); ++i)
+	{
+		const auto bracket = BracketOf(seq[i].opcode());
+		if (bracket.kind == BracketKind::none)
+		{
+			EXPECT_EQ(index.partner(i), BlockIndex::npos);
+			continue;
+		}
+
+		const auto partner = index.partner(i);
+		EXPECT_EQ(index.partner(partner), i);
+		EXPECT_EQ(index.depth(partner), index.depth(i));
+		EXPECT_EQ(BracketOf(seq[partner].opcode()).kind, bracket.kind);
+
+		if (bracket.opening)
+		{
+			std::size_t nesting = 0, end = i;
+			do
+			{
+				const auto inner = BracketOf(seq[end].opcode());
+				if (inner.kind != BracketKind::none) nesting += inner.opening ? 1 : -1;
+				++end;
+			} while (nesting != 0);
+
+			EXPECT_EQ(index.skip(i), end);
+			EXPECT_EQ(index.depth(i + 1), index.depth(i) + 1);
+		}
+	}
+
+	using I = Instruction;
+	EXPECT_THROW(BlockIndex::Build(std::vector<Instruction>{ I::Block::Begin(), I::Function::End() }), std::invalid_argument);
+	EXPECT_THROW(BlockIndex::Build(std::vector<Instruction>{ I::Object::End() }), std::invalid_argument);
+	EXPECT_THROW(BlockIndex::Build(std::vector<Instruction>{ I::Function::Begin(), I::Block::Begin(), I::Block::Drop() }), std::invalid_argument);
+
+	const auto simple = BlockIndex::Build(std::vector<Instruction>{ I::Function::Begin(), I::Literal::Null(), I::Function::End(), I::Literal::Null() });
+	EXPECT_EQ(simple.skip(0), 3);
+	EXPECT_EQ(simple.skip(2), 3);
+	EXPECT_EQ(simple.depth(1), 1);
+	EXPECT_EQ(simple.depth(3), 0);
+	EXPECT_THROW(simple.skip(1), std::invalid_argument);
+}
+
+TEST(Instruction, IRText)
+{
+	using I = Instruction;
+
+	const std::vector<Instruction> seq = {
+		I::Block::NamedBegin("outer"),
+		I::Literal::Int(-42),
+		I::Literal::Int(std::numeric_limits<IRValue::Int>::min()),
+		I::Literal::Float(1),
+		I::Literal::Float(-0.0),
+		I::Literal::Float(0.1),
+		I::Literal::Float(6.78e-90),
+		I::Literal::Float(std::numeric_limits<IRValue::Float>::infinity()),
+		I::Literal::String("tab\t \"quoted\" back\\slash # not a comment\n"),
+		I::Literal::Bool(false),
+		I::Literal::Null(),
+		I::Literal::Undef(),
+		I::Control::JumpIfElseTo(3, 7),
+		I::Make(OpcodeId::None, { IRValue::Undef{}, nullptr }),
+		I::Block::End(),
+	};
+
+	const auto text = IRText::Disassemble(seq);
+	EXPECT_EQ(IRText::Assemble(text), seq);
+
+	std::ostringstream out;
+	IRText::Disassemble(seq, out);
+	EXPECT_EQ(out.str(), text);
+
+	EXPECT_EQ(ToString(I::Literal::Float(1)), "Literal::Float 1.0");
+	EXPECT_EQ(ToString(I::Object::Use("a")), "Object::Use \"a\"");
+	EXPECT_EQ(ToString(I::Control::JumpIfElseTo(3, 7)), "Control::JumpIfElseTo 3 7");
+
+	EXPECT_EQ(IRText::Assemble("# a comment\n\n  Object::Var \"x\"   # trailing\r\nBlock::End\n"),
+		(std::vector<Instruction>{ I::Object::Var("x"), I::Block::End() }));
+
+	EXPECT_THROW(IRText::Assemble("Block::Nothing"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Literal::Int 12x"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Literal::String \"open"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Literal::String \"a\"1"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Literal::Int 99999999999999999999"), std::invalid_argument);
+
+	// operands are checked against the signature of the opcode
+	EXPECT_THROW(IRText::Assemble("Block::Begin 1 2 3"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Object::Use"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Literal::Int \"x\""), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Literal::Float 1"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Control::Mark"), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Control::JumpIfElse \"a\""), std::invalid_argument);
+	EXPECT_THROW(IRText::Assemble("Control::JumpTo \"a\""), std::invalid_argument);
+	try
+	{
+		IRText::Assemble("Block::Begin\nObject::Use 1\n");
+		ADD_FAILURE();
+	}
+	catch (const std::invalid_argument& e)
+	{
+		EXPECT_STREQ(e.what(), "IRText: line 2: operand 1 of 'Object::Use' is not a string");
+	}
+	EXPECT_THROW(IRText::Assemble("Literal::Float 1e999"), std::invalid_argument);
+	EXPECT_EQ(IRText::Assemble("Literal::Float 99999999999999999999.0"), (std::vector<Instruction>{ I::Literal::Float(1e20) }));
+
+	// floats take the fewest digits that read back exactly
+	EXPECT_EQ(ToString(I::Literal::Float(0.1)), "Literal::Float 0.1");
+	EXPECT_EQ(ToString(I::Literal::Float(1e100)), "Literal::Float 1e+100");
+	for (const auto f : { 0.1 + 0.2, 1.0 / 3, std::numeric_limits<double>::max(), std::numeric_limits<double>::denorm_min() })
+	{
+		EXPECT_EQ(IRText::Assemble(ToString(I::Literal::Float(f))), (std::vector<Instruction>{ I::Literal::Float(f) }));
+	}
+
+	// round-trip large dumps
+	std::vector<Instruction> large;
+	for (int i = 0; i < 10000; ++i)
+	{
+		large.push_back(I::Literal::Float(i / 7.0));
+		large.push_back(I::Object::Use("v" + std::to_string(i)));
+	}
+
+	std::ostringstream largeOut;
+	IRText::Disassemble(large, largeOut);
+	EXPECT_EQ(IRText::Assemble(largeOut.str()), large);
+}
+
+TEST(Instruction, IRTextLocale)
+{
+	using I = Instruction;
+
+	// a host may use a locale with a decimal comma, which printf and strtod follow
+	const std::string previous = std::setlocale(LC_NUMERIC, nullptr);
+	const char* comma = nullptr;
+	for (const auto name : { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "de_DE", "German" })
+	{
+		if (std::setlocale(LC_NUMERIC, name) && std::localeconv()->decimal_point == ","s)
+		{
+			comma = name;
+			break;
+		}
+	}
+	if (!comma)
+	{
+		std::setlocale(LC_NUMERIC, previous.c_str());
+		GTEST_SKIP();
+	}
+
+	const std::vector<Instruction> seq = { I::Literal::Float(2.5), I::Literal::Float(1.0 / 3), I::Literal::Float(1e-300) };
+	const auto text = IRText::Disassemble(seq);
+	const auto assembled = IRText::Assemble(text);
+	const auto rejected = [] { try { IRText::Assemble("Literal::Float 2,5"); } catch (const std::invalid_argument&) { return true; } return false; }();
+
+	std::setlocale(LC_NUMERIC, previous.c_str());
+
+	EXPECT_EQ(text.find(','), std::string::npos);
+	EXPECT_EQ(text.substr(0, text.find('\n')), "Literal::Float 2.5");
+	EXPECT_EQ(assembled, seq);
+	EXPECT_TRUE(rejected);
+}
+
+TEST(Instruction, Optimizer)
+{
+	using I = Instruction;
+
+	// 1; (2), [1, [2.5]]; x
+	const std::string_view source = "1; (2), [1, [2.5]]; x";
+
+	ParseTree tree;
+	Parser::Expression(Parser::MakeInfo(source, tree.modifier()));
+	const auto seq = IRGenerator::Generate(tree);
+
+	const auto result = Optimizer::Optimize(seq);
+
+	EXPECT_EQ(result.code, (std::vector<Instruction>{
+		I::Literal::Int(1),
+		I::Literal::Constant(1),
+		I::Object::Use("x"),
+	}));
+
+	ASSERT_EQ(result.constants.size(), 2);
+	EXPECT_EQ(result.constants[0], (std::vector<Instruction>{
+		I::Block::Begin(), I::Object::Use("array.literal"), I::Literal::Float(2.5), I::Function::Call()
+	}));
+	EXPECT_EQ(result.constants[1], (std::vector<Instruction>{
+		I::Block::Begin(), I::Object::Use("array.literal"), I::Literal::Int(1), I::Literal::Constant(0), I::Function::Call()
+	}));
+
+	EXPECT_EQ(result.stats.inputSize, seq.size());
+	EXPECT_EQ(result.stats.outputSize, 3);
+	EXPECT_EQ(result.stats.foldedLiterals, 2);
+	EXPECT_EQ(result.stats.droppedBlocks, 1);
+	EXPECT_EQ(result.stats.unwrappedBlocks, 3);
+
+	// malformed brackets are reported, not rewritten
+	EXPECT_THROW(Optimizer::Optimize({ I::Block::Begin(), I::Literal::Int(1), I::Function::End() }), std::invalid_argument);
+	EXPECT_THROW(Optimizer::Optimize({ I::Object::Begin(), I::Object::Var("a"), I::Block::End() }), std::invalid_argument);
+	EXPECT_THROW(Optimizer::Optimize({ I::Block::Begin(), I::Literal::Int(1) }), std::invalid_argument);
+	EXPECT_THROW(Optimizer::Optimize({ I::Block::End() }), std::invalid_argument);
+
+	// the generator emits no operator calls yet, so on its output foldOperators finds nothing to fold
+	{
+		ParseTree operators;
+		Parser::Expression(Parser::MakeInfo("1 + 2", operators.modifier()));
+		EXPECT_THROW(IRGenerator::Generate(operators), std::invalid_argument);
+
+		ParseTree program;
+		Parser::Expression(Parser::MakeInfo("var (a, c...) (1; [2.33, null, \"s\"]); const x [a, c]; [1, [2, [x]]], a", program.modifier()));
+		const auto generated = IRGenerator::Generate(program);
+		const auto optimized = Optimizer::Optimize(generated);
+		EXPECT_EQ(optimized.stats.foldedOperators, 0);
+		EXPECT_GT(optimized.stats.foldedLiterals, 0);
+
+		Optimizer::Options noOperators;
+		noOperators.foldOperators = false;
+		EXPECT_EQ(Optimizer::Optimize(generated, noOperators).code, optimized.code);
+	}
+
+	// every pass turned off
+	Optimizer::Options off;
+	off.unwrapBlocks = off.dropDeadBlocks = off.foldOperators = off.foldLiterals = false;
+	EXPECT_EQ(Optimizer::Optimize(seq, off).code, seq);
+
+	auto call = [](std::string_view op, std::vector<Instruction> args)
+	{
+		std::vector<Instruction> seq{ I::Block::Begin(), I::Object::Use(std::string(op)) };
+		seq.insert(seq.end(), args.begin(), args.end());
+		seq.push_back(I::Function::Call());
+		return seq;
+	};
+	auto fold = [](const std::vector<Instruction>& seq)
+	{
+		return Optimizer::Optimize(seq).code;
+	};
+	using Seq = std::vector<Instruction>;
+
+	EXPECT_EQ(fold(call("+", { I::Literal::Int(2), I::Literal::Int(3) })), Seq{ I::Literal::Int(5) });
+	EXPECT_EQ(fold(call("*", { I::Literal::Int(2), I::Literal::Float(0.25) })), Seq{ I::Literal::Float(0.5) });
+	EXPECT_EQ(fold(call("-", { I::Literal::Int(7) })), Seq{ I::Literal::Int(-7) });
+	EXPECT_EQ(fold(call("not", { I::Literal::Bool(true) })), Seq{ I::Literal::Bool(false) });
+	EXPECT_EQ(fold(call("<>", { I::Literal::Int(1), I::Literal::Float(1.0) })), Seq{ I::Literal::Bool(false) });
+	EXPECT_EQ(fold(call("==", { I::Literal::String("a"), I::Literal::String("a") })), Seq{ I::Literal::Bool(true) });
+	EXPECT_EQ(fold(call("+", { I::Literal::String("a"), I::Literal::String("b") })), Seq{ I::Literal::String("ab") });
+	EXPECT_EQ(fold(call("and", { I::Literal::Bool(true), I::Literal::Bool(false) })), Seq{ I::Literal::Bool(false) });
+
+	// the operands of a folded operator may themselves be folded
+	auto nested = call("+", { I::Literal::Int(1) });
+	const auto inner = call("*", { I::Literal::Int(2), I::Literal::Int(3) });
+	nested.insert(nested.end() - 1, inner.begin(), inner.end());
+	EXPECT_EQ(fold(nested), Seq{ I::Literal::Int(7) });
+
+	// left to the runtime: overflow, integer division, unknown functions and mixed kinds
+	for (const auto& kept : {
+		call("+", { I::Literal::Int(std::numeric_limits<IRValue::Int>::max()), I::Literal::Int(1) }),
+		call("*", { I::Literal::Int(std::numeric_limits<IRValue::Int>::min()), I::Literal::Int(-1) }),
+		call("/", { I::Literal::Int(1), I::Literal::Int(2) }),
+		call("f", { I::Literal::Int(1), I::Literal::Int(2) }),
+		call("+", { I::Literal::Int(1), I::Literal::String("a") }),
+		call("+", { I::Literal::Int(1), I::Object::Use("a") }),
+	})
+	{
+		EXPECT_EQ(fold(kept), kept);
+	}
+
+	EXPECT_THROW(Optimizer::Optimize({ I::Control::JumpTo(0) }), std::invalid_argument);
+}
+
+TEST(Instruction, ControlFlowGraph)
+{
+	using Kind = ControlFlowGraph::ValueKind;
+
+	// print(true ? 2 : 1), the value of the condition joining in a phi
+	const auto diamond = IRText::Assemble(R"(
+		Block::Begin
+		Object::Use "print"
+		Literal::Bool true
+		Control::JumpIf "then"
+		Literal::Int 1
+		Control::Jump "join"
+		Control::Mark "then"
+		Literal::Int 2
+		Control::Mark "join"
+		Function::Call
+	)");
+
+	for (const auto& seq : { diamond, Linker::Link(diamond) })
+	{
+		const auto graph = ControlFlowGraph::Build(seq);
+		const auto& blocks = graph.blocks();
+		const auto& values = graph.values();
+
+		ASSERT_EQ(blocks.size(), 4);
+		EXPECT_EQ(blocks[0].successors, (std::vector<ControlFlowGraph::Index>{ 2, 1 }));
+		EXPECT_EQ(blocks[1].successors, std::vector<ControlFlowGraph::Index>{ 3 });
+		EXPECT_EQ(blocks[3].predecessors, (std::vector<ControlFlowGraph::Index>{ 1, 2 }));
+
+		// only the slot on which the branches disagree gets a phi
+		ASSERT_EQ(blocks[3].phis.size(), 1);
+		const auto& phi = values[blocks[3].phis[0]];
+		EXPECT_EQ(phi.kind, Kind::phi);
+		ASSERT_EQ(phi.operands.size(), 2);
+		EXPECT_EQ(values[phi.operands[0]].instruction, blocks[1].begin);
+		EXPECT_EQ(values[phi.operands[1]].instruction, blocks[2].end - 1);
+
+		const auto& call = graph.operation(seq.size() - 1);
+		ASSERT_EQ(call.operands.size(), 2);
+		EXPECT_EQ(call.operands[0], graph.operation(1).result);
+		EXPECT_EQ(call.operands[1], blocks[3].phis[0]);
+		EXPECT_EQ(values[call.result].kind, Kind::instruction);
+
+		for (ControlFlowGraph::Index b = 1; b < 4; ++b) EXPECT_EQ(graph.idom(b), 0);
+		EXPECT_TRUE(graph.dominates(0, 3));
+		EXPECT_FALSE(graph.dominates(1, 3));
+	}
+
+	// a loop gets a phi for every slot of its header
+	const auto loop = IRText::Assemble(R"(
+		Block::Begin
+		Object::Use "f"
+		Control::Mark "loop"
+		Block::Begin
+		Object::Use "more"
+		Function::Call
+		Control::JumpIf "loop"
+		Function::Call
+	)");
+
+	const auto graph = ControlFlowGraph::Build(loop);
+	ASSERT_EQ(graph.blocks().size(), 3);
+	EXPECT_EQ(graph.blocks()[1].successors, (std::vector<ControlFlowGraph::Index>{ 1, 2 }));
+	EXPECT_EQ(graph.reversePostOrder(), (std::vector<ControlFlowGraph::Index>{ 0, 1, 2 }));
+
+	ASSERT_EQ(graph.blocks()[1].phis.size(), 1);
+	const auto header = graph.blocks()[1].phis[0];
+	EXPECT_EQ(graph.values()[header].operands, (std::vector<ControlFlowGraph::Index>{ graph.operation(1).result, header }));
+	EXPECT_EQ(graph.operation(7).operands, std::vector<ControlFlowGraph::Index>{ header });
+
+	EXPECT_EQ(graph.idom(2), 1);
+	EXPECT_TRUE(graph.dominates(1, 2));
+	EXPECT_EQ(graph.dominatorTree()[0], std::vector<ControlFlowGraph::Index>{ 1 });
+
+	// a function is one value, its body having a graph of its own
+	const auto lambda = IRText::Assemble(R"(
+		Function::Begin
+		Block::Begin
+		Object::Var "x"
+		Block::End
+		Object::Use "x"
+		Function::End
+	)");
+
+	const auto outer = ControlFlowGraph::Build(lambda);
+	EXPECT_EQ(outer.values().size(), 1);
+	EXPECT_EQ(outer.operation(0).result, 0);
+
+	const auto body = ControlFlowGraph::Build(lambda, 1, lambda.size() - 1);
+	EXPECT_EQ(body.blocks().size(), 1);
+	EXPECT_EQ(body.operation(lambda.size() - 2).result, body.values().size() - 1);
+
+	// generated code: a pattern element closed by Block::Drop stays a declaration of the pattern,
+	// Block::End keeps every value of its block and Block::Drop discards the others
+	{
+		ParseTree tree;
+		Parser::Expression(Parser::MakeInfo("var (a, c...) (1; [2.33, null, \"s\"]); (1; 2), 3", tree.modifier()));
+		const auto seq = IRGenerator::Generate(tree);
+		const auto graph = ControlFlowGraph::Build(seq);
+
+		auto sources = [&](const std::vector<ControlFlowGraph::Index>& operands)
+		{
+			std::vector<Instruction> instructions;
+			for (auto value : operands) instructions.push_back(seq[graph.values()[value].instruction]);
+			return instructions;
+		};
+
+		const auto define = std::find(seq.begin(), seq.end(), Instruction::Object::EndWithInit()) - seq.begin();
+		EXPECT_EQ(sources(graph.operation(define).operands), (std::vector<Instruction>{
+			Instruction::Object::Var("a"), Instruction::Object::VarPack("c"), Instruction::Literal::Int(1), Instruction::Function::Call()
+		}));
+
+		// the block of (1; 2) holds both values, then the ',' after it discards them
+		const auto drop = std::find(seq.begin() + define, seq.end(), Instruction::Block::Drop()) - seq.begin();
+		EXPECT_EQ(sources(graph.operation(drop).operands), (std::vector<Instruction>{ Instruction::Literal::Int(1), Instruction::Literal::Int(2) }));
+	}
+
+	// a jump to the end of the range joins the fall-through in the exit block, which leaves the results
+	const auto exit = ControlFlowGraph::Build(IRText::Assemble(R"(
+		Literal::Int 1
+		Literal::Bool true
+		Control::JumpIfTo 4
+		Control::Mark "last"
+	)"));
+	ASSERT_EQ(exit.blocks().size(), 3);
+	EXPECT_EQ(exit.blocks()[2].predecessors, (std::vector<ControlFlowGraph::Index>{ 0, 1 }));
+	EXPECT_EQ(exit.results(), std::vector<ControlFlowGraph::Index>{ exit.operation(0).result });
+	EXPECT_EQ(body.results(), (std::vector<ControlFlowGraph::Index>{ 0, 1 }));
+
+	// the stacks of the predecessors of a join must have the same shape
+	EXPECT_THROW(ControlFlowGraph::Build(IRText::Assemble(R"(
+		Literal::Bool true
+		Control::JumpIf "join"
+		Literal::Int 1
+		Control::Mark "join"
+	)")), std::invalid_argument);
+	EXPECT_THROW(ControlFlowGraph::Build({ Instruction::Control::Jump("nowhere") }), std::invalid_argument);
+
+	// a function body is opaque to the code around it
+	const std::vector<Instruction> intoBody = {
+		Instruction::Control::JumpTo(2),
+		Instruction::Function::Begin(),
+		Instruction::Literal::Int(1),
+		Instruction::Function::End(),
+	};
+	try
+	{
+		ControlFlowGraph::Build(intoBody);
+		ADD_FAILURE();
+	}
+	catch (const std::invalid_argument& e)
+	{
+		EXPECT_STREQ(e.what(), "ControlFlowGraph: jump into a function body at instruction 0");
+	}
+	const std::vector<Instruction> outOfBody = { Instruction::Function::Begin(), Instruction::Control::JumpTo(3), Instruction::Function::End() };
+	EXPECT_THROW(ControlFlowGraph::Build(outOfBody, 1, 2), std::invalid_argument);
+	EXPECT_NO_THROW(ControlFlowGraph::Build({ Instruction::Control::JumpTo(1), Instruction::Function::Begin(), Instruction::Function::End() }));
+}
+
+TEST(Instruction, RegisterLowering)
+{
+	using Op = RegisterOpcode;
+	using Code = std::vector<RegisterInstruction>;
+
+	// print(true ? 2 : 1): the move on the edge from the else branch shares its slot and goes away
+	const auto diamond = IRText::Assemble(R"(
+		Block::Begin
+		Object::Use "print"
+		Literal::Bool true
+		Control::JumpIf "then"
+		Literal::Int 1
+		Control::Jump "join"
+		Control::Mark "then"
+		Literal::Int 2
+		Control::Mark "join"
+		Function::Call
+	)");
+
+	const auto lowered = RegisterLowering::Lower(diamond);
+	ASSERT_EQ(lowered.functions.size(), 1);
+
+	const auto& function = lowered.functions[0];
+	EXPECT_EQ(function.code, (Code{
+		{ Op::Use, OpcodeId::ObjectUse, 0, {}, { "print"s } },
+		{ Op::Literal, OpcodeId::LiteralBool, 1, {}, { true } },
+		{ Op::JumpIf, OpcodeId::None, noRegister, { 1 }, { IRValue::Int(5) } },
+		{ Op::Literal, OpcodeId::LiteralInt, 1, {}, { IRValue::Int(1) } },
+		{ Op::Jump, OpcodeId::None, noRegister, {}, { IRValue::Int(7) } },
+		{ Op::Literal, OpcodeId::LiteralInt, 2, {}, { IRValue::Int(2) } },
+		{ Op::Move, OpcodeId::None, 1, { 2 }, {} },
+		{ Op::Call, OpcodeId::FunctionCall, 0, { 0, 1 }, {} },
+		{ Op::Return, OpcodeId::None, noRegister, { 0 }, {} },
+	}));
+	EXPECT_EQ(function.frameSize, 3);
+	EXPECT_EQ(function.stackSize, diamond.size());
+
+	// with two registers the phi, living longest, is spilled
+	RegisterLowering::Options small;
+	small.frameSize = 2;
+	const auto spilled = RegisterLowering::Lower(diamond, small).functions[0];
+	const Register memory = firstSpillSlot;
+	EXPECT_EQ(spilled.code, (Code{
+		{ Op::Use, OpcodeId::ObjectUse, 0, {}, { "print"s } },
+		{ Op::Literal, OpcodeId::LiteralBool, 1, {}, { true } },
+		{ Op::JumpIf, OpcodeId::None, noRegister, { 1 }, { IRValue::Int(6) } },
+		{ Op::Literal, OpcodeId::LiteralInt, 1, {}, { IRValue::Int(1) } },
+		{ Op::Move, OpcodeId::None, memory, { 1 }, {} },
+		{ Op::Jump, OpcodeId::None, noRegister, {}, { IRValue::Int(8) } },
+		{ Op::Literal, OpcodeId::LiteralInt, 1, {}, { IRValue::Int(2) } },
+		{ Op::Move, OpcodeId::None, memory, { 1 }, {} },
+		{ Op::Call, OpcodeId::FunctionCall, 0, { 0, memory }, {} },
+		{ Op::Return, OpcodeId::None, noRegister, { 0 }, {} },
+	}));
+	EXPECT_EQ(spilled.frameSize, 2);
+	EXPECT_EQ(spilled.spillSize, 1);
+	EXPECT_TRUE(IsSpillSlot(memory));
+	EXPECT_FALSE(IsSpillSlot(1));
+	EXPECT_FALSE(IsSpillSlot(noRegister));
+
+	// one register instruction per value for straight-line code, functions lowered on their own
+	ParseTree tree;
+	Parser::Expression(Parser::MakeInfo("var (a, c...) (1; [2.33, null, \"s\"]); const x [a, c]; [1, [2, [x]]], a", tree.modifier()));
+	const auto seq = IRGenerator::Generate(tree);
+
+	const auto straight = RegisterLowering::Lower(seq);
+	const auto& code = straight.functions[0].code;
+	EXPECT_LT(code.size(), seq.size());
+	EXPECT_TRUE(std::none_of(code.begin(), code.end(), [](const RegisterInstruction& instruction) { return instruction.opcode == Op::Move; }));
+
+	std::size_t stackBytes = 0, registerBytes = 0;
+	for (const auto& instruction : seq) stackBytes += RegisterLowering::EncodedSize(instruction);
+	for (const auto& instruction : code) registerBytes += RegisterLowering::EncodedSize(instruction);
+	EXPECT_GT(stackBytes, 0);
+	EXPECT_GT(registerBytes, 0);
+
+	const auto lambda = IRText::Assemble(R"(
+		Function::Begin
+		Block::Begin
+		Object::Var "x"
+		Block::End
+		Object::Use "x"
+		Function::End
+	)");
+	const auto closures = RegisterLowering::Lower(lambda);
+	ASSERT_EQ(closures.functions.size(), 2);
+	EXPECT_EQ(closures.functions[0].code, (Code{
+		{ Op::Closure, OpcodeId::FunctionBegin, 0, {}, { IRValue::Int(1) } },
+		{ Op::Return, OpcodeId::None, noRegister, { 0 }, {} },
+	}));
+	EXPECT_EQ(closures.functions[1].code, (Code{
+		{ Op::Declare, OpcodeId::ObjectVar, 0, {}, { "x"s } },
+		{ Op::Use, OpcodeId::ObjectUse, 1, {}, { "x"s } },
+		{ Op::Return, OpcodeId::None, noRegister, { 0, 1 }, {} },
+	}));
+	EXPECT_EQ(closures.instructionCount(), 5);
+
+	// the values left at the end stay live until the return
+	const auto results = RegisterLowering::Lower(IRText::Assemble(R"(
+		Block::Begin
+		Literal::Int 1
+		Block::End
+		Block::Begin
+		Literal::Int 2
+		Block::End
+	)"));
+	EXPECT_EQ(results.functions[0].code, (Code{
+		{ Op::Literal, OpcodeId::LiteralInt, 0, {}, { IRValue::Int(1) } },
+		{ Op::Literal, OpcodeId::LiteralInt, 1, {}, { IRValue::Int(2) } },
+		{ Op::Return, OpcodeId::None, noRegister, { 0, 1 }, {} },
+	}));
+	EXPECT_EQ(results.functions[0].frameSize, 2);
+
+	// more values live at once than the frame holds: the rest go to spill slots
+	std::vector<Instruction> many;
+	for (int i = 0; i < 300; ++i)
+	{
+		many.insert(many.end(), { Instruction::Block::Begin(), Instruction::Literal::Int(i), Instruction::Block::End() });
+	}
+	const auto crowded = RegisterLowering::Lower(many).functions[0];
+	EXPECT_EQ(crowded.frameSize, 256);
+	EXPECT_EQ(crowded.spillSize, 44);
+	ASSERT_EQ(crowded.code.size(), 301);
+
+	const auto& returned = crowded.code.back();
+	ASSERT_EQ(returned.opcode, Op::Return);
+	ASSERT_EQ(returned.operands.size(), 300);
+	EXPECT_EQ(std::set<Register>(returned.operands.begin(), returned.operands.end()).size(), 300);
+	EXPECT_EQ(std::count_if(returned.operands.begin(), returned.operands.end(), IsSpillSlot), 44);
+	for (std::size_t i = 0; i < 300; ++i) EXPECT_EQ(crowded.code[i].result, returned.operands[i]);
+}
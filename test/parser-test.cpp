@@ -3,40 +3,22 @@
 
 #include <gtest/gtest.h>
 #include <chtholly.hpp>
+#include <chtholly/flattree.hpp>
+#include <chtholly/hashcons.hpp>
+#include <chtholly/treeimage.hpp>
+#include <chtholly/sourceindex.hpp>
+#include <chtholly/parallelvisit.hpp>
 
-using namespace Chtholly;
-
-std::string ToString(const ParseTree::Observer& v)
-{
-	std::string out;
-
-	const auto isTerm = v.value().type == ParseUnit::Type::term;
-
-	if (isTerm) out += '(';
-
-	if (isTerm)
-	{
-		out += v.value().name + ' ';
-	}
-	else
-	{
-		out += v.value().name + '[' + std::string(v.value().value) + "] ";
-	}
-
-	for (auto i = v.childrenBegin(); i != v.childrenEnd(); ++i)
-	{
-		out += ToString(i);
-	}
-
-	if (isTerm) out += ')';
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
 
-	return out;
-}
+using namespace Chtholly;
 
 std::ostream& operator<<(std::ostream& out, const ParseTree& tree)
 {
-	out << ToString(tree.observer());
-	return out;
+	return WriteTree(out, tree.observer());
 }
 
 ParseTree parseString(const std::string_view& input_string)
@@ -1192,3 +1174,483 @@ TEST(Expression, DictList)
 		)
 	));
 }
+
+template <typename Observer>
+bool SameShape(const ParseTree::Observer& lhs, const Observer& rhs)
+{
+	if (lhs.value() != rhs.value() || lhs.childrenSize() != rhs.childrenSize()) return false;
+	if (lhs.childrenEmpty()) return rhs.childrenEmpty();
+
+	if ((--lhs.childrenEnd()).value() != (--rhs.childrenEnd()).value()) return false;
+
+	auto j = rhs.childrenBegin();
+	for (auto i = lhs.childrenBegin(); i != lhs.childrenEnd(); ++i, ++j)
+	{
+		if (j.parent() != rhs || !SameShape(i, j)) return false;
+	}
+
+	return j == rhs.childrenEnd();
+}
+
+TEST(Tree, FlatParseTree)
+{
+	for (auto input : {
+		"1",
+		"var (a, b : int, c...) (1, 2.5; \"s\")",
+		"{0 : 1, while((var i(0) +=1) < 10) i:i+1}",
+		"fn (x) if (x > 0) x * 2 else -x; [], {a, b}"
+	})
+	{
+		const auto tree = parseString(input);
+		const FlatParseTree flat(tree);
+
+		EXPECT_TRUE(SameShape(tree.observer(), flat.observer())) << input;
+		EXPECT_EQ(flat, FlatParseTree(tree));
+	}
+}
+
+TEST(Tree, ParseUnitName)
+{
+	EXPECT_EQ(ParseUnitName("IntLiteral"), ParseUnitName::Predefined("IntLiteral"));
+	EXPECT_EQ(ParseUnitName("IntLiteral").str(), "IntLiteral");
+	EXPECT_LT(ParseUnitName("PairExpression").id(), ParseUnitName::predefinedSize);
+
+	const ParseUnitName custom = "SomeUserDefinedTerm";
+	EXPECT_GE(custom.id(), ParseUnitName::predefinedSize);
+	EXPECT_EQ(custom, ParseUnitName(std::string("SomeUserDefinedTerm")));
+	EXPECT_NE(custom, ParseUnitName("Identifier"));
+	EXPECT_EQ(ParseUnitName::FromId(custom.id()).str(), "SomeUserDefinedTerm");
+
+	EXPECT_EQ(parseString("a").observer().childrenFrontValue().name, ParseUnitName::Predefined("Identifier"));
+}
+
+TEST(Tree, MoveSubtree)
+{
+	ParseTree tree(
+		Term("Expression",
+			Term("ArrayList", Token("IntLiteral", "1")),
+			Token("Separator", ";"),
+			Token("Identifier", "x")
+		)
+	);
+
+	auto list = tree.modifier().childrenBegin().childrenBegin();
+	auto identifier = --list.thisEnd();
+	auto moved = identifier.thisMoveTo(list.childrenBegin());
+
+	EXPECT_EQ(moved, list.childrenBegin());
+	EXPECT_TRUE(tree.checkParent());
+	EXPECT_EQ(tree, ParseTree(
+		Term("Expression",
+			Term("ArrayList", Token("Identifier", "x"), Token("IntLiteral", "1")),
+			Token("Separator", ";")
+		)
+	));
+
+	const auto nested = parseString("((((((1 + 2))))))");
+	EXPECT_TRUE(nested.checkParent());
+	EXPECT_EQ(nested, ParseTree(
+		Term("AdditiveExpression",
+			Token("IntLiteral", "1"),
+			Token("BinaryOperator", "+"),
+			Token("IntLiteral", "2")
+		)
+	));
+}
+
+TEST(Tree, ArenaParseTree)
+{
+	const auto input = "var (a, b : int) (1, 2); fn (x) x * a + b";
+
+	MonotonicArena arena;
+	{
+		ArenaParseTree tree(std::allocator_arg, arena);
+		ArenaParser::Expression(ArenaParser::MakeInfo(input, tree.modifier()));
+
+		EXPECT_TRUE(tree.checkParent());
+		EXPECT_GT(arena.used(), 0u);
+		EXPECT_EQ(FlatParseTree(tree), FlatParseTree(parseString(input)));
+	}
+
+	arena.release();
+	EXPECT_EQ(arena.reserved(), 0u);
+
+	// an unaligned block tail: aligning the cursor steps past the end of the first block
+	MonotonicArena small(16);
+	small.allocate(9, 1);
+	const auto reserved = small.reserved();
+
+	const auto aligned = small.allocate(8, 8);
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 8, 0u);
+	EXPECT_GT(small.reserved(), reserved);
+}
+
+TEST(Tree, DeepTree)
+{
+	const ParseUnitName expression = "Expression";
+	constexpr auto depth = 200000;
+
+	ParseTree tree;
+	auto modi = tree.modifier();
+	for (int i = 0; i < depth; ++i)
+	{
+		modi.childrenPushBack(ParseUnit::Type::term, expression);
+		modi = modi.childrenBegin();
+	}
+	modi.childrenPushBack(ParseUnit::Type::token, "Identifier", "x");
+
+	const ParseTree& source = tree;
+	const ParseTree copy(source);
+
+	EXPECT_TRUE(copy.checkParent());
+	EXPECT_EQ(copy, tree);
+
+	modi.childrenBegin().value().value = "y";
+	EXPECT_FALSE(copy == tree);
+
+	tree = copy;
+	tree.fixParent();
+	EXPECT_TRUE(tree.checkParent());
+	EXPECT_EQ(copy, tree);
+}
+
+TEST(Tree, HashCons)
+{
+	const auto lhs = parseString("f(x + 1, x + 1); g(x + 1)");
+	const auto rhs = parseString("f(x + 1, x + 1); g(x + 1)");
+	const auto other = parseString("f(x + 1, x + 2); g(x + 1)");
+
+	EXPECT_EQ(StructuralHash(lhs.observer()), StructuralHash(rhs.observer()));
+	EXPECT_NE(StructuralHash(lhs.observer()), StructuralHash(other.observer()));
+	EXPECT_EQ(StructuralHash(lhs.observer()), StructuralHash(FlatParseTree(lhs).observer()));
+
+	ParseHashConsPool pool;
+
+	const auto lhsRef = pool.intern(lhs.observer());
+	const auto size = pool.size();
+
+	EXPECT_EQ(lhsRef, pool.intern(rhs.observer()));
+	EXPECT_EQ(size, pool.size());
+	EXPECT_NE(lhsRef, pool.intern(other.observer()));
+
+	EXPECT_EQ(lhsRef->hash(), StructuralHash(lhs.observer()));
+	EXPECT_EQ(lhsRef->value(), lhs.observer().value());
+
+	// the three "x + 1" are shared
+	std::size_t nodes = 0;
+	for (std::vector<ParseTree::Observer> pending{ lhs.observer() }; !pending.empty();)
+	{
+		auto current = pending.back();
+		pending.pop_back();
+		++nodes;
+		for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child) pending.push_back(child);
+	}
+	EXPECT_LT(size, nodes);
+
+	// the spellings are owned by the pool, not by the source buffer
+	ParseHashConsPool::Ref fromBuffer;
+	{
+		std::string buffer = "h(y)";
+		fromBuffer = pool.intern(parseString(buffer).observer());
+		buffer.assign(buffer.size(), '#');
+	}
+	EXPECT_EQ(fromBuffer, pool.intern(parseString("h(y)").observer()));
+
+	auto leaf = fromBuffer;
+	while (!leaf->children().empty()) leaf = leaf->children().back();
+	EXPECT_EQ(leaf->value().value, "y");
+}
+
+TEST(Tree, CachedHash)
+{
+	auto lhs = parseString("f(x + 1, x + 1); g(x + 1)");
+	const auto rhs = parseString("f(x + 1, x + 1); g(x + 1)");
+	const auto other = parseString("f(x + 1, x + 2); g(x + 1)");
+
+	EXPECT_EQ(lhs.hash(), StructuralHash(lhs.observer()));
+	EXPECT_EQ(lhs.hash(), rhs.hash());
+	EXPECT_NE(lhs.hash(), other.hash());
+
+	EXPECT_EQ(lhs, rhs);
+	EXPECT_FALSE(lhs == other);
+
+	// a change clears the cached hashes above it
+	auto leaf = lhs.modifier();
+	while (!leaf.childrenEmpty()) leaf = --leaf.childrenEnd();
+	leaf.value().value = "2";
+
+	EXPECT_FALSE(lhs == rhs);
+	EXPECT_EQ(lhs.hash(), StructuralHash(lhs.observer()));
+	EXPECT_NE(lhs.hash(), rhs.hash());
+
+	leaf.value().value = "1";
+	EXPECT_EQ(lhs.hash(), rhs.hash());
+	EXPECT_EQ(lhs, rhs);
+
+	lhs.modifier().childrenPopBack();
+	EXPECT_EQ(lhs.hash(), StructuralHash(lhs.observer()));
+	EXPECT_FALSE(lhs == rhs);
+}
+
+TEST(Tree, ParseTreeImage)
+{
+	const std::string_view source = "var (a, b : int, c...) (1, 2.5; \"s\"); fn (x) if (x > 0) x * 2 else -x";
+	const auto tree = parseString(source);
+
+	std::ostringstream out(std::ios::binary);
+	WriteParseTreeImage(out, tree, source);
+	const auto bytes = out.str();
+
+	// a copy into aligned storage, as the image is navigated in place
+	std::vector<std::uint32_t> buffer(bytes.size() / sizeof(std::uint32_t) + 1);
+	std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+	const ParseTreeImage image(buffer.data(), bytes.size());
+	EXPECT_TRUE(SameShape(tree.observer(), image.observer()));
+
+	// a tree built by hand doesn't refer to any source
+	const ParseTree built(Term("Expression", Token("IntLiteral", "1"), Token("Separator", ";"), Term("ArrayList")));
+	std::ostringstream builtOut(std::ios::binary);
+	WriteParseTreeImage(builtOut, built);
+	const auto builtBytes = builtOut.str();
+	std::memcpy(buffer.data(), builtBytes.data(), builtBytes.size());
+	EXPECT_TRUE(SameShape(built.observer(), ParseTreeImage(buffer.data(), builtBytes.size()).observer()));
+
+	const std::string path = "parse-tree-image-test.bin";
+	std::ofstream(path, std::ios::binary) << bytes;
+	{
+		const ParseTreeImage mapped(path);
+		EXPECT_EQ(mapped.size(), image.size());
+		EXPECT_TRUE(SameShape(tree.observer(), mapped.observer()));
+	}
+	std::remove(path.c_str());
+
+	std::memcpy(buffer.data(), bytes.data(), bytes.size());
+	EXPECT_THROW(ParseTreeImage(buffer.data(), bytes.size() - 1), std::runtime_error);
+	EXPECT_THROW(ParseTreeImage(buffer.data(), 4), std::runtime_error);
+
+	// let the last node be its own parent
+	const auto records = reinterpret_cast<TreeImage::Record*>(reinterpret_cast<char*>(buffer.data()) + sizeof(TreeImage::Header));
+	records[image.size() - 1].parent = TreeImage::Index(image.size() - 1);
+	EXPECT_THROW(ParseTreeImage(buffer.data(), bytes.size()), std::runtime_error);
+}
+
+TEST(Tree, WriteTree)
+{
+	const ParseTree tree(
+		Term("Expression",
+			Token("StringLiteral", "\"a\\b\""),
+			Token("Separator", ";"),
+			Term("ArrayList")
+		)
+	);
+
+	EXPECT_EQ(TreeToString(tree.observer()),
+		R"((root (Expression StringLiteral["a\b"] Separator[;] (ArrayList ))))");
+
+	EXPECT_EQ(TreeToString(tree.observer(), TreeFormat::json),
+		R"({"type":"term","name":"root","children":[{"type":"term","name":"Expression","children":[)"
+		R"({"type":"token","name":"StringLiteral","value":"\"a\\b\""},)"
+		R"({"type":"token","name":"Separator","value":";"},)"
+		R"({"type":"term","name":"ArrayList","children":[]}]}]})");
+
+	EXPECT_EQ(TreeToString(tree.observer(), TreeFormat::indented),
+		"root\n  Expression\n    StringLiteral [\"a\\b\"]\n    Separator [;]\n    ArrayList\n");
+
+	std::ostringstream out;
+	WriteTree(out, tree.observer(), TreeFormat::json);
+	EXPECT_EQ(out.str(), TreeToString(tree.observer(), TreeFormat::json));
+
+	EXPECT_EQ(TreeToString<wchar_t>(BasicParseTree<std::wstring_view>(BasicParseTree<std::wstring_view>::Token("Identifier", L"x")).observer()),
+		L"(root Identifier[x] )");
+}
+
+TEST(Parser, EventParser)
+{
+	using TreeSink = BasicTreeSink<ParseTree>;
+
+	for (auto input : {
+		"1",
+		"a; b,; c,",
+		"var (a, b : int, c...) (1, 2.5; \"s\")",
+		"{0 : 1, while((var i(0) +=1) < 10) i:i+1}",
+		"fn (x) if (x > 0) x * 2 else -x; [], {a, b}",
+		"do { x += 1 } while (x < 3); return; break 1,; continue",
+		"f(x...) + a.b.c(1)(2) == not 1 and 2 or [3,",
+		"fn () (; ) ; ("
+	})
+	{
+		const auto expected = parseString(input);
+
+		ParseTree tree;
+		TreeSink sink(tree.modifier());
+		EventParser<TreeSink>::Builder::Context context(sink);
+
+		const auto rest = EventParser<TreeSink>::Expression(EventParser<TreeSink>::MakeInfo(input, context.cursor())).first;
+		context.finish();
+
+		EXPECT_EQ(tree, expected) << input;
+		EXPECT_TRUE(tree.checkParent()) << input;
+
+		ParseTree reference;
+		EXPECT_EQ(rest, Parser::Expression(Parser::MakeInfo(input, reference.modifier())).first) << input;
+	}
+}
+
+TEST(Parser, EventSink)
+{
+	struct Counter
+	{
+		std::size_t terms = 0, tokens = 0, collapsed = 0, discarded = 0;
+		std::vector<std::string_view> identifiers;
+
+		void enterTerm(const ParseUnitName&) { ++terms; }
+		void token(const ParseUnitName& name, std::string_view value)
+		{
+			++tokens;
+			if (name == ParseUnitName::Predefined("Identifier")) identifiers.push_back(value);
+		}
+		void exitTerm(bool isCollapsed) { collapsed += isCollapsed; }
+		void discard() { ++discarded; }
+	};
+
+	const std::string_view input = "var (a, b) (1, x + y)";
+
+	std::size_t terms = 0, tokens = 0;
+	const auto tree = parseString(input);
+	for (std::vector<ParseTree::Observer> pending{ tree.observer().childrenBegin() }; !pending.empty();)
+	{
+		auto current = pending.back();
+		pending.pop_back();
+
+		++(current.value().type == ParseUnit::Type::term ? terms : tokens);
+		for (auto child = current.childrenBegin(); child != current.childrenEnd(); ++child) pending.push_back(child);
+	}
+
+	Counter counter;
+	EventParser<Counter>::Builder::Context context(counter);
+	EventParser<Counter>::Expression(EventParser<Counter>::MakeInfo(input, context.cursor()));
+	context.finish();
+
+	EXPECT_EQ(counter.identifiers, (std::vector<std::string_view>{ "a", "b", "x", "y" }));
+	EXPECT_EQ(counter.tokens - counter.discarded, tokens);
+	EXPECT_EQ(counter.terms - counter.collapsed, terms);
+}
+
+TEST(Tree, SourceIndex)
+{
+	std::string source = "var (a, b)\n(1,\n\n  \"a string which is long enough to fill a whole block\"); x\r\ny";
+	for (int i = 0; i < 5; ++i) source += source;
+
+	const SourceIndex index(source);
+
+	std::size_t line = 1, column = 1;
+	for (std::size_t offset = 0; offset <= source.size(); ++offset)
+	{
+		EXPECT_EQ(index.position(offset), (SourceIndex::Position{ line, column })) << offset;
+
+		if (offset < source.size() && source[offset] == '\n') ++line, column = 1;
+		else ++column;
+	}
+	EXPECT_EQ(index.lineCount(), line);
+	EXPECT_EQ(index.line(2), "(1,");
+	EXPECT_EQ(index.line(3), "");
+	EXPECT_EQ(index.line(index.lineCount()), "y");
+	EXPECT_THROW(index.position(source.size() + 1), std::out_of_range);
+
+	// a unit value is located in its source
+	const auto tree = parseString(std::string_view(source).substr(0, 10));
+	std::vector<SourceIndex::Position> identifiers;
+	for (std::vector<ParseTree::Observer> pending{ tree.observer() }; !pending.empty();)
+	{
+		auto current = pending.back();
+		pending.pop_back();
+
+		if (current.value().name == ParseUnitName::Predefined("Identifier")) identifiers.push_back(index.position(current.value().value));
+		for (auto child = current.childrenEnd(); child != current.childrenBegin();) pending.push_back(--child);
+	}
+	EXPECT_EQ(identifiers, (std::vector<SourceIndex::Position>{ { 1, 6 }, { 1, 9 } }));
+}
+
+TEST(Tree, Stats)
+{
+	const ParseTree tree(
+		Term("Expression",
+			Term("ArrayList", Token("IntLiteral", "1")),
+			Token("Separator", ";"),
+			Token("IntLiteral", "2")
+		)
+	);
+
+	const auto stats = tree.stats();
+
+	EXPECT_EQ(stats.nodeCount, 6);
+	EXPECT_EQ(stats.maxDepth, 4);
+	EXPECT_EQ(stats.fanOut, (std::vector<std::size_t>{ 3, 2, 0, 1 }));
+	EXPECT_EQ(stats.singleChildCount, 2);
+	EXPECT_DOUBLE_EQ(stats.singleChildShare(), 2.0 / 6);
+	EXPECT_EQ(stats.nodeBytes, 6 * ParseTree::nodeAllocationSize);
+
+	EXPECT_EQ(stats.tokenCount, 3);
+	EXPECT_EQ(stats.termCount, 3);
+	EXPECT_EQ(stats.nameCount, (std::map<std::string, std::size_t>{ { "root", 1 }, { "Expression", 1 }, { "ArrayList", 1 }, { "IntLiteral", 2 }, { "Separator", 1 } }));
+	EXPECT_EQ(stats.nameBytes, 6 * sizeof(ParseUnitName) + std::string("rootExpressionArrayListIntLiteralSeparator").size());
+
+	const auto deep = parseString("f(g(h(x)))").stats();
+	EXPECT_EQ(deep.nodeCount, deep.tokenCount + deep.termCount);
+	EXPECT_LT(deep.singleChildShare(), 1.0);
+}
+
+TEST(Tree, ParallelVisit)
+{
+	const auto tree = parseString("var (a, b) (1, x + y); fn (x) x * z; [c, {d : e}]; f(g, h(i))");
+	const auto expression = tree.observer().childrenBegin();
+
+	using Names = std::vector<std::string_view>;
+
+	const auto collect = [](const ParseTree::Observer& root)
+	{
+		Names names;
+		for (std::vector<ParseTree::Observer> pending{ root }; !pending.empty();)
+		{
+			auto current = pending.back();
+			pending.pop_back();
+
+			if (current.value().name == ParseUnitName::Predefined("Identifier")) names.push_back(current.value().value);
+			for (auto child = current.childrenEnd(); child != current.childrenBegin();) pending.push_back(--child);
+		}
+		return names;
+	};
+
+	const auto concat = [](Names lhs, Names rhs)
+	{
+		lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+		return lhs;
+	};
+
+	const auto expected = collect(tree.observer());
+	EXPECT_EQ(expected.size(), 14);
+
+	for (std::size_t threads : { 0, 1, 4 })
+	{
+		ThreadPool pool(threads);
+
+		EXPECT_EQ(ParallelVisitChildren<Names>(pool, expression, collect, concat), expected);
+
+		// every identifier as a task of its own
+		EXPECT_EQ(ParallelVisit<Names>(pool, tree.observer(),
+			[](const ParseTree::Observer& node) { return node.value().type == ParseUnit::Type::token; },
+			collect, concat), expected);
+
+		// tasks waiting for nested tasks
+		EXPECT_EQ(ParallelVisitChildren<Names>(pool, expression, [&](const ParseTree::Observer& child)
+		{
+			return ParallelVisitChildren<Names>(pool, child, collect, concat, child.childrenEmpty() ? collect(child) : Names{});
+		}, concat), expected);
+
+		EXPECT_THROW(ParallelVisitChildren<int>(pool, expression, [](const ParseTree::Observer&) -> int
+		{
+			throw std::runtime_error("visit");
+		}, std::plus<int>{}), std::runtime_error);
+	}
+}